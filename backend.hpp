@@ -0,0 +1,109 @@
+#pragma once
+
+#include "thud_types.hpp"
+#include "instances.hpp"
+
+enum MapMode
+{
+  // the previous contents are dropped, and the GPU keeps any it still needs
+  kMapDiscard,
+  // the caller promises not to touch anything the GPU may still read
+  kMapNoOverwrite,
+};
+
+// A mappable stream of fixed-stride elements. Thud writes vertices into the
+// pointer returned by map(), and unmap() closes the stream and returns how many
+// elements were written.
+struct VertexSink
+{
+  virtual ~VertexSink() {}
+  // the start of the sink, whatever the mode
+  virtual void *map(MapMode mode = kMapDiscard) = 0;
+  // end is one past the last element written, so writing after an offset
+  // counts the elements before it too
+  virtual int unmap(void *end) = 0;
+  virtual int stride() const = 0;
+  virtual int capacity() const = 0;
+};
+
+// A marker in the commands sent to the GPU, for finding out when it's done
+// with what was drawn before it
+struct Fence
+{
+  virtual ~Fence() {}
+  // after the draws issued so far. A fence can be inserted again once it
+  // has passed
+  virtual void insert() = 0;
+  // whether the GPU is past the marker, without waiting for it
+  virtual bool passed() = 0;
+};
+
+// contents of the vertex shader constant buffer
+struct FrameConstants
+{
+  // PosCol vertices are output as pos * scale + bias
+  D3DXVECTOR4 scale;
+  D3DXVECTOR4 bias;
+  // instances are in screen space, and are output as
+  // pos * screen_to_clip.xy + screen_to_clip.zw
+  D3DXVECTOR4 screen_to_clip;
+  // PackedVertex positions are decoded to pos * packed.xy + packed.zw,
+  // which then goes through scale and bias like a PosCol
+  D3DXVECTOR4 packed;
+  // the size of a pixel in screen units in xy, which the analytic shapes
+  // measure their edges in. zw are unused
+  D3DXVECTOR4 pixel_size;
+};
+
+enum BlendMode
+{
+  // the device's default blend state, opaque on the headless backend
+  kBlendDefault,
+  // src * a + dst * (1 - a), depends on draw order
+  kBlendAlpha,
+  // src * a + dst
+  kBlendAdditive,
+  kNumBlendModes
+};
+
+// Everything Thud needs from the graphics API. The D3D11 implementation lives
+// in d3d11_backend.cpp, and HeadlessBackend records the draws in memory.
+struct Backend
+{
+  virtual ~Backend() {}
+  virtual bool init() = 0;
+  virtual void close() = 0;
+
+  // size of the render target in pixels
+  virtual D3DXVECTOR2 extents() const = 0;
+
+  virtual VertexSink *create_vertex_sink(int stride, int capacity) = 0;
+  // stride is 2 or 4 bytes
+  virtual VertexSink *create_index_sink(int stride, int capacity) = 0;
+  // holds RectInstance, LineInstance or ShapeInstance records
+  virtual VertexSink *create_instance_sink(int stride, int capacity) = 0;
+
+  // Sinks that keep their contents between frames, for geometry that rarely
+  // changes. They can't be mapped, and are written with update instead
+  virtual VertexSink *create_static_vertex_sink(int stride, int capacity) = 0;
+  virtual VertexSink *create_static_index_sink(int stride, int capacity) = 0;
+  // copy count elements from data to [first, first+count) of a static sink
+  virtual void update(VertexSink *sink, int first, const void *data, int count) = 0;
+
+  virtual Fence *create_fence() = 0;
+
+  virtual void start_frame(const FrameConstants& constants) = 0;
+  // replace the constants for the draws that follow, as each canvas has its own
+  virtual void set_constants(const FrameConstants& constants) = 0;
+
+  // used by the draws that follow
+  virtual void set_blend(BlendMode mode) = 0;
+
+  // draw [first, first+count) from the sink as a PosCol triangle list
+  virtual void draw(VertexSink *sink, int first, int count) = 0;
+  // draw indices [first, first+count) as a triangle list, with base_vertex
+  // added to each index
+  virtual void draw_indexed(VertexSink *verts, VertexSink *indices, int first, int count, int base_vertex) = 0;
+  // expand instances [first, first+count) into 6 vertices each
+  virtual void draw_instanced(InstanceKind kind, VertexSink *instances, int first, int count) = 0;
+};
@@ -0,0 +1,112 @@
+// Micro benchmark for ArcLengthTable. Builds the table for a 200 point
+// spline, then maps 1M random and 1M sorted distances to t, with the table's
+// direct index and with a plain binary search over the same lengths. Also
+// reports how far the spacing of points placed at even distances strays
+// from even. Times are best of 10.
+//
+//   g++ -O2 -I.. arc_length_bench.cpp ../bezier.cpp
+
+#include "../stdafx.h"
+#include "../bezier.hpp"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace
+{
+  const int kNumPoints = 200;
+  const int kNumS = 1 << 20;
+  const int kPasses = 10;
+
+  template<typename Fn>
+  double best_of(Fn fn)
+  {
+    double best = 1e30;
+    for (int i = 0; i < kPasses; ++i) {
+      const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+      fn();
+      const chrono::duration<double> d = chrono::high_resolution_clock::now() - start;
+      best = min(best, d.count());
+    }
+    return best;
+  }
+
+  void report(const char *name, double seconds, int n)
+  {
+    printf("%-28s %8.3f ms %8.3f ns/query\n", name, seconds * 1000, seconds * 1e9 / n);
+  }
+
+  float binary_search(const ArcLengthTable& table, float s)
+  {
+    const vector<float>& lengths = table.lengths();
+    s = max(0.0f, min(table.length(), s));
+    const int j = max(0, min((int)lengths.size() - 2,
+      (int)(upper_bound(lengths.begin(), lengths.end(), s) - lengths.begin()) - 1));
+    const float span = lengths[j+1] - lengths[j];
+    return (j + (span > 0 ? (s - lengths[j]) / span : 0)) / table.steps();
+  }
+
+  float distance(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+  {
+    const D3DXVECTOR3 d = b - a;
+    return sqrtf(d.x*d.x + d.y*d.y + d.z*d.z);
+  }
+}
+
+int main()
+{
+  vector<D3DXVECTOR3> pts(kNumPoints);
+  for (int i = 0; i < kNumPoints; ++i)
+    pts[i] = D3DXVECTOR3(i * 10.0f, 300 * sinf(i * 0.3f), 5 * cosf(i * 0.1f));
+  const Bezier b = Bezier::from_points(AsArray<D3DXVECTOR3>(&pts[0], kNumPoints));
+
+  ArcLengthTable table;
+  const int build_steps[] = { 8, 16, 64 };
+  for (int i = 0; i < 3; ++i) {
+    const double t = best_of([&] { table.build(b, build_steps[i]); });
+    printf("build, %2d steps               %8.3f ms\n", build_steps[i], t * 1000);
+  }
+
+  // 10000 points placed at even distances, and how far the distance
+  // between neighbours strays from the mean
+  const int kMarkers = 10000;
+  vector<float> gaps(kMarkers);
+  for (int i = 0; i < 3; ++i) {
+    table.build(b, build_steps[i]);
+    D3DXVECTOR3 prev = b.interpolate(table.parameter(0));
+    double sum = 0;
+    for (int k = 0; k < kMarkers; ++k) {
+      const D3DXVECTOR3 cur = b.interpolate(table.parameter((k + 1) * table.length() / kMarkers));
+      gaps[k] = distance(prev, cur);
+      sum += gaps[k];
+      prev = cur;
+    }
+    const float mean = (float)(sum / kMarkers);
+    float worst = 0;
+    for (int k = 0; k < kMarkers; ++k)
+      worst = max(worst, fabsf(gaps[k] - mean) / mean);
+    printf("spacing error, %2d steps        %7.3f %%\n", build_steps[i], worst * 100);
+  }
+
+  table.build(b, 16);
+  vector<float> s(kNumS), t(kNumS);
+  for (int i = 0; i < kNumS; ++i)
+    s[i] = rand() / (float)RAND_MAX * table.length();
+  report("lut, random s", best_of([&] { table.parameters(&s[0], &t[0], kNumS); }), kNumS);
+  report("binary search, random s", best_of([&] {
+    for (int i = 0; i < kNumS; ++i)
+      t[i] = binary_search(table, s[i]);
+  }), kNumS);
+  sort(s.begin(), s.end());
+  report("lut, sorted s", best_of([&] { table.parameters(&s[0], &t[0], kNumS); }), kNumS);
+  report("binary search, sorted s", best_of([&] {
+    for (int i = 0; i < kNumS; ++i)
+      t[i] = binary_search(table, s[i]);
+  }), kNumS);
+  return 0;
+}
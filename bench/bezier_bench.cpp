@@ -0,0 +1,69 @@
+// Micro benchmark for evaluating Bezier splines. A 200 point spline is
+// sampled at 5000 steps per segment with interpolate(t) in a loop and with
+// sample(), and evaluated at 1M sorted random t with interpolate(t) and the
+// batch interpolate. Reports ns per point, best of 10.
+//
+//   g++ -O2 -I.. bezier_bench.cpp ../bezier.cpp
+
+#include "../stdafx.h"
+#include "../bezier.hpp"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace
+{
+  const int kNumPoints = 200;
+  const int kSteps = 5000;
+  const int kNumT = 1 << 20;
+  const int kPasses = 10;
+
+  template<typename Fn>
+  double best_of(Fn fn)
+  {
+    double best = 1e30;
+    for (int i = 0; i < kPasses; ++i) {
+      const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+      fn();
+      const chrono::duration<double> d = chrono::high_resolution_clock::now() - start;
+      best = min(best, d.count());
+    }
+    return best;
+  }
+
+  void report(const char *name, double seconds, int n)
+  {
+    printf("%-28s %8.3f ms %8.3f ns/point\n", name, seconds * 1000, seconds * 1e9 / n);
+  }
+}
+
+int main()
+{
+  vector<D3DXVECTOR3> pts(kNumPoints);
+  for (int i = 0; i < kNumPoints; ++i)
+    pts[i] = D3DXVECTOR3(i * 10.0f, 300 * sinf(i * 0.3f), 5 * cosf(i * 0.1f));
+  const Bezier b = Bezier::from_points(AsArray<D3DXVECTOR3>(&pts[0], kNumPoints));
+
+  const int num_samples = b.num_samples(kSteps);
+  vector<D3DXVECTOR3> out(max(num_samples, kNumT));
+  report("interpolate(t), uniform", best_of([&] {
+    for (int i = 0; i < num_samples; ++i)
+      out[i] = b.interpolate(i / (float)kSteps);
+  }), num_samples);
+  report("sample", best_of([&] { b.sample(kSteps, &out[0]); }), num_samples);
+
+  vector<float> t(kNumT);
+  for (int i = 0; i < kNumT; ++i)
+    t[i] = rand() / (float)RAND_MAX * (kNumPoints - 1);
+  sort(t.begin(), t.end());
+  report("interpolate(t), sorted t", best_of([&] {
+    for (int i = 0; i < kNumT; ++i)
+      out[i] = b.interpolate(t[i]);
+  }), kNumT);
+  report("batch interpolate, sorted t", best_of([&] { b.interpolate(&t[0], &out[0], kNumT); }), kNumT);
+  return 0;
+}
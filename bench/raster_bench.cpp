@@ -0,0 +1,106 @@
+// Throughput benchmark for the SoftwareBackend, on two 1920x1080 frames:
+// "shapes" is 4K circles, 4K rects and 4K long lines, a quarter of them
+// alpha blended, and "fill" is 16 full screen rects front to back. Each is
+// drawn through Thud and rasterized on pools of 1 to N cores (the calling
+// thread plus N-1 workers). Reports the best rasterize time per core count,
+// as triangles and megapixels (fragments written) per second. Setup happens
+// as the draws come in, so it's timed separately.
+//
+//   g++ -O2 -pthread -I.. raster_bench.cpp ../software_backend.cpp ../thud.cpp
+//     ../recorder.cpp ../task_pool.cpp ../tessellate.cpp ../draw_list.cpp
+//     ../vertex_arena.cpp ../circle_table.cpp ../screen_to_clip.cpp
+//     ../instances.cpp ../headless_backend.cpp ../bezier.cpp ../cull.cpp
+
+#include "../stdafx.h"
+#include "../thud.hpp"
+#include "../software_backend.hpp"
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace
+{
+  const int kWidth = 1920;
+  const int kHeight = 1080;
+  const int kNumShapes = 4096;
+  const int kNumFills = 16;
+  const int kPasses = 10;
+
+  float frand(float lo, float hi)
+  {
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+  }
+
+  void draw_shapes(Thud& thud)
+  {
+    srand(1);
+    thud.set_circle_tolerance(0.25f);
+    for (int i = 0; i < kNumShapes; ++i) {
+      thud.set_blend(i % 4 == 0 ? kBlendAlpha : kBlendDefault);
+      thud.set_fill(D3DXCOLOR(frand(0, 1), frand(0, 1), frand(0, 1), 0.5f));
+      const D3DXVECTOR3 p(frand(0, kWidth), frand(0, kHeight), frand(0, 1));
+      thud.circle(p, frand(2, 24));
+      thud.rect(p, D3DXVECTOR3(frand(4, 64), frand(4, 64), 0));
+      thud.line(p, D3DXVECTOR3(frand(0, kWidth), frand(0, kHeight), p.z), frand(1, 4));
+    }
+  }
+
+  void draw_fill(Thud& thud)
+  {
+    for (int i = 0; i < kNumFills; ++i) {
+      thud.set_fill(D3DXCOLOR(i / (float)kNumFills, 0.5f, 0.25f, 1));
+      thud.rect(D3DXVECTOR3(0, 0, 1 - (i + 1) / (float)(kNumFills + 1)), D3DXVECTOR3(kWidth, kHeight, 0));
+    }
+  }
+
+  void run(const char *name, void (*draw_scene)(Thud&), int max_cores)
+  {
+    Thud::Options options;
+    options.indexed = true;
+
+    double base = 0;
+    for (int cores = 1; cores <= max_cores; ++cores) {
+      SoftwareBackend *backend = new SoftwareBackend(kWidth, kHeight, cores - 1);
+      Thud& thud = Thud::instance();
+      if (!thud.init(backend, options))
+        exit(1);
+      thud.set_extents(D3DXVECTOR2(kWidth, kHeight));
+
+      double best = 1e30, best_setup = 1e30;
+      for (int pass = 0; pass < kPasses; ++pass) {
+        thud.start_frame();
+        draw_scene(thud);
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        thud.render();
+        const chrono::duration<double> setup = chrono::high_resolution_clock::now() - start;
+        start = chrono::high_resolution_clock::now();
+        backend->rasterize();
+        const chrono::duration<double> d = chrono::high_resolution_clock::now() - start;
+        best = min(best, d.count());
+        best_setup = min(best_setup, setup.count());
+      }
+      if (cores == 1) {
+        base = best;
+        printf("%s: %d triangles, %.2f MP written, setup %.3f ms\n",
+          name, backend->num_rasterized, backend->num_fragments / 1e6, best_setup * 1000);
+      }
+      printf("%2d cores %8.3f ms %8.2f Mtri/s %8.1f MP/s %6.2fx\n", cores, best * 1000,
+        backend->num_rasterized / best / 1e6, backend->num_fragments / best / 1e6, base / best);
+      thud.close();
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const int hw = (int)thread::hardware_concurrency();
+  const int max_cores = argc > 1 ? atoi(argv[1]) : max(1, hw);
+
+  printf("%dx%d, %d hardware threads\n", kWidth, kHeight, hw);
+  run("shapes", draw_shapes, max_cores);
+  run("fill", draw_fill, max_cores);
+  return 0;
+}
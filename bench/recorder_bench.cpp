@@ -0,0 +1,77 @@
+// Scaling benchmark for the Recorders. A frame is 256 widgets of 64 circles
+// and 64 lines each, recorded with Thud::record on pools of 1 to N cores (the
+// calling thread plus N-1 workers), on the headless backend. Reports the best
+// record time per core count, which includes the serial merge into the canvas,
+// and the speedup over one core.
+//
+//   g++ -O2 -pthread -I.. recorder_bench.cpp ../thud.cpp ../recorder.cpp ../task_pool.cpp
+//     ../tessellate.cpp ../draw_list.cpp ../vertex_arena.cpp ../circle_table.cpp
+//     ../screen_to_clip.cpp ../instances.cpp ../headless_backend.cpp ../bezier.cpp
+//     ../cull.cpp
+
+#include "../stdafx.h"
+#include "../thud.hpp"
+#include "../recorder.hpp"
+#include "../task_pool.hpp"
+#include "../headless_backend.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+namespace
+{
+  const int kNumWidgets = 256;
+  const int kShapesPerWidget = 64;
+  const int kPasses = 10;
+
+  void widget(int idx, Recorder& r)
+  {
+    const float x = (float)(idx % 16) * 64;
+    const float y = (float)(idx / 16) * 48;
+    r.set_fill(D3DXCOLOR(idx / (float)kNumWidgets, 0.5f, 0.25f, 1));
+    r.set_circle_tolerance(0.25f);
+    for (int i = 0; i < kShapesPerWidget; ++i) {
+      const float t = (float)i / kShapesPerWidget;
+      r.circle(D3DXVECTOR3(x + 64 * t, y + 24, 0), 2 + 10 * t);
+      r.line(D3DXVECTOR3(x, y + 48 * t, 0), D3DXVECTOR3(x + 64, y + 48 * (1 - t), 0), 1.5f);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const int hw = (int)thread::hardware_concurrency();
+  const int max_cores = argc > 1 ? atoi(argv[1]) : max(1, hw);
+
+  Thud& thud = Thud::instance();
+  Thud::Options options;
+  options.indexed = true;
+  if (!thud.init(new HeadlessBackend(1024, 768), options))
+    return 1;
+  thud.set_extents(D3DXVECTOR2(1024, 768));
+
+  printf("%d widgets, %d circles + %d lines each, %d hardware threads\n",
+    kNumWidgets, kShapesPerWidget, kShapesPerWidget, hw);
+
+  double base = 0;
+  for (int cores = 1; cores <= max_cores; ++cores) {
+    TaskPool pool(cores - 1);
+    double best = 1e30;
+    for (int pass = 0; pass < kPasses; ++pass) {
+      thud.start_frame();
+      const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+      thud.record(pool, kNumWidgets, widget);
+      const chrono::duration<double> d = chrono::high_resolution_clock::now() - start;
+      thud.render();
+      best = min(best, d.count());
+    }
+    if (cores == 1)
+      base = best;
+    printf("%2d cores %8.3f ms %6.2fx\n", cores, best * 1000, base / best);
+  }
+
+  thud.close();
+  return 0;
+}
@@ -0,0 +1,357 @@
+// Benchmark suite for the CPU hot paths, for catching regressions between
+// releases. Each benchmark is warmed up, then timed in passes of at least
+// 20 ms, and the best pass is reported as ns per item, where an item is a
+// primitive, point, vertex or solve. Vertices are counted as the triangle
+// list vertices the backend is asked to draw, and allocations are heap
+// allocations per call, from operator new and from the Matrix2d allocator,
+// measured on one call after the warm up.
+//
+// Thud runs on a backend that only counts what it's asked to draw, so the
+// numbers cover emission and tessellation, not the backend.
+//
+//   thud_bench [--json | --csv] [--filter substring] [--passes n]
+
+#include "../stdafx.h"
+#include "../thud.hpp"
+#include "../bezier.hpp"
+#include "../frame_arena.hpp"
+#include "../headless_backend.hpp"
+#include "../matrix2d.hpp"
+#include "../screen_to_clip.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define THUD_NOINLINE __attribute__((noinline))
+#else
+#define THUD_NOINLINE
+#endif
+
+using namespace std;
+
+namespace
+{
+  atomic<long long> g_allocs(0);
+  atomic<long long> g_alloc_bytes(0);
+  long long g_vertices = 0;
+}
+
+void *operator new(size_t bytes)
+{
+  ++g_allocs;
+  g_alloc_bytes += bytes;
+  void *p = malloc(bytes ? bytes : 1);
+  if (!p)
+    throw bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t bytes)
+{
+  return operator new(bytes);
+}
+
+// not inlined, so gcc doesn't pair the free with the caller's new and warn
+THUD_NOINLINE void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+THUD_NOINLINE void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+namespace
+{
+  const int kWidth = 1920;
+  const int kHeight = 1080;
+  const double kMinPassSeconds = 0.02;
+
+  // counts the vertices of each draw, and draws nothing
+  struct CountingBackend : public HeadlessBackend
+  {
+    CountingBackend() : HeadlessBackend(kWidth, kHeight) {}
+    virtual void draw(VertexSink *, int, int count) { g_vertices += count; }
+    virtual void draw_indexed(VertexSink *, VertexSink *, int, int count, int) { g_vertices += count; }
+    virtual void draw_instanced(InstanceKind, VertexSink *, int, int count) { g_vertices += 6 * count; }
+  };
+
+  // the heap, counted like operator new
+  struct CountingAllocator : public Allocator
+  {
+    virtual void *allocate(size_t bytes, size_t align)
+    {
+      ++g_allocs;
+      g_alloc_bytes += bytes;
+      return aligned_malloc(bytes, align);
+    }
+    virtual void release(void *p) { aligned_free(p); }
+  };
+
+  struct Result
+  {
+    string name;
+    int items;
+    double ns_per_item;
+    double verts_per_sec;
+    long long allocs;
+    long long alloc_bytes;
+  };
+
+  enum Format { kText, kCsv, kJson };
+
+  struct Suite
+  {
+    Suite() : format(kText), filter(nullptr), passes(5) {}
+
+    // fn handles items items per call
+    template<typename Fn>
+    void run(const string& name, int items, Fn fn)
+    {
+      if (filter && name.find(filter) == string::npos)
+        return;
+
+      fn();
+      const long long allocs = g_allocs, alloc_bytes = g_alloc_bytes, vertices = g_vertices;
+      fn();
+      Result r;
+      r.allocs = g_allocs - allocs;
+      r.alloc_bytes = g_alloc_bytes - alloc_bytes;
+      r.name = name;
+      r.items = items;
+      const long long verts = g_vertices - vertices;
+
+      int reps = 1;
+      double best = 1e30;
+      for (int pass = 0; pass < passes; ++pass) {
+        const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < reps; ++i)
+          fn();
+        const chrono::duration<double> d = chrono::high_resolution_clock::now() - start;
+        best = min(best, d.count() / reps);
+        // the first pass sizes the others
+        if (pass == 0 && d.count() < kMinPassSeconds)
+          reps = (int)min(1e6, ceil(kMinPassSeconds / max(1e-9, best)));
+      }
+      r.ns_per_item = best * 1e9 / items;
+      r.verts_per_sec = verts / best;
+
+      if (format == kText)
+        printf("%-36s %10.2f ns/item %10.2f Mverts/s %8lld allocs %10lld bytes\n",
+          r.name.c_str(), r.ns_per_item, r.verts_per_sec / 1e6, r.allocs, r.alloc_bytes);
+      results.push_back(r);
+    }
+
+    void print() const
+    {
+      if (format == kCsv) {
+        printf("name,items,ns_per_item,items_per_sec,verts_per_sec,allocs,alloc_bytes\n");
+        for (size_t i = 0; i < results.size(); ++i) {
+          const Result& r = results[i];
+          printf("%s,%d,%.3f,%.1f,%.1f,%lld,%lld\n", r.name.c_str(), r.items, r.ns_per_item,
+            1e9 / r.ns_per_item, r.verts_per_sec, r.allocs, r.alloc_bytes);
+        }
+      } else if (format == kJson) {
+        printf("{\n  \"simd\": \"%s\",\n  \"benchmarks\": [\n", simd());
+        for (size_t i = 0; i < results.size(); ++i) {
+          const Result& r = results[i];
+          printf("    {\"name\": \"%s\", \"items\": %d, \"ns_per_item\": %.3f, \"items_per_sec\": %.1f, "
+            "\"verts_per_sec\": %.1f, \"allocs\": %lld, \"alloc_bytes\": %lld}%s\n",
+            r.name.c_str(), r.items, r.ns_per_item, 1e9 / r.ns_per_item, r.verts_per_sec,
+            r.allocs, r.alloc_bytes, i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+      }
+    }
+
+    // the widest simd path the build enables
+    static const char *simd()
+    {
+#if defined(__AVX2__) || defined(__AVX__)
+      return "avx";
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+      return "sse2";
+#else
+      return "scalar";
+#endif
+    }
+
+    Format format;
+    const char *filter;
+    int passes;
+    vector<Result> results;
+  };
+
+  float frand(float lo, float hi)
+  {
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+  }
+
+  // suffix is added to the names, to tell the option sets apart
+  void thud_benchmarks(Suite& suite, const Thud::Options& options, const string& suffix)
+  {
+    const int kPrims = 1000;
+    Thud& thud = Thud::instance();
+    if (!thud.init(new CountingBackend(), options))
+      exit(1);
+    thud.set_extents(D3DXVECTOR2(kWidth, kHeight));
+    thud.set_circle_tolerance(0.25f);
+
+    srand(1);
+    vector<D3DXVECTOR3> pos(kPrims), other(kPrims);
+    vector<float> size(kPrims);
+    for (int i = 0; i < kPrims; ++i) {
+      pos[i] = D3DXVECTOR3(frand(50, kWidth - 50), frand(50, kHeight - 50), frand(0, 1));
+      other[i] = D3DXVECTOR3(frand(0, kWidth), frand(0, kHeight), pos[i].z);
+      size[i] = frand(4, 40);
+    }
+
+    // a frame of kPrims primitives, from start_frame to render
+    suite.run("thud/circle" + suffix, kPrims, [&] {
+      thud.start_frame();
+      for (int i = 0; i < kPrims; ++i)
+        thud.circle(pos[i], size[i]);
+      thud.render();
+    });
+    suite.run("thud/rect" + suffix, kPrims, [&] {
+      thud.start_frame();
+      for (int i = 0; i < kPrims; ++i)
+        thud.rect(pos[i], D3DXVECTOR3(size[i], size[i], 0));
+      thud.render();
+    });
+    suite.run("thud/rounded_rect" + suffix, kPrims, [&] {
+      thud.start_frame();
+      for (int i = 0; i < kPrims; ++i)
+        thud.rounded_rect(pos[i], D3DXVECTOR3(2 * size[i], size[i], 0), 0.25f * size[i]);
+      thud.render();
+    });
+    suite.run("thud/line" + suffix, kPrims, [&] {
+      thud.start_frame();
+      for (int i = 0; i < kPrims; ++i)
+        thud.line(pos[i], other[i], 2);
+      thud.render();
+    });
+
+    thud.close();
+  }
+
+  void to_clip_benchmarks(Suite& suite)
+  {
+    const int kVerts = 4096;
+    ScreenToClip s;
+    s.screen_extents = s.pixel_extents = D3DXVECTOR2(kWidth, kHeight);
+    s.update();
+    vector<D3DXVECTOR2> src(kVerts), dst(kVerts);
+    for (int i = 0; i < kVerts; ++i)
+      src[i] = D3DXVECTOR2(frand(0, kWidth), frand(0, kHeight));
+
+    suite.run("screen_to_clip/to_clip", kVerts, [&] {
+      s.to_clip(&src[0], &dst[0], kVerts);
+      g_vertices += kVerts;
+    });
+  }
+
+  void bezier_benchmarks(Suite& suite)
+  {
+    const int kSizes[] = { 10, 100, 1000, 10000, 100000 };
+    for (int k = 0; k < (int)(sizeof(kSizes) / sizeof(kSizes[0])); ++k) {
+      const int n = kSizes[k];
+      vector<D3DXVECTOR3> pts(n);
+      for (int i = 0; i < n; ++i)
+        pts[i] = D3DXVECTOR3(i * 10.0f, 300 * sinf(i * 0.3f), 5 * cosf(i * 0.1f));
+      suite.run("bezier/from_points/" + to_string(n), n, [&] {
+        Bezier::from_points(AsArray<D3DXVECTOR3>(&pts[0], n));
+      });
+    }
+
+    const int kPoints = 200;
+    const int kNumT = 1 << 16;
+    vector<D3DXVECTOR3> pts(kPoints);
+    for (int i = 0; i < kPoints; ++i)
+      pts[i] = D3DXVECTOR3(i * 10.0f, 300 * sinf(i * 0.3f), 5 * cosf(i * 0.1f));
+    const Bezier b = Bezier::from_points(AsArray<D3DXVECTOR3>(&pts[0], kPoints));
+    vector<float> t(kNumT);
+    for (int i = 0; i < kNumT; ++i)
+      t[i] = frand(0, kPoints - 1);
+    sort(t.begin(), t.end());
+    vector<D3DXVECTOR3> out(kNumT);
+
+    suite.run("bezier/interpolate", kNumT, [&] {
+      for (int i = 0; i < kNumT; ++i)
+        out[i] = b.interpolate(t[i]);
+    });
+    suite.run("bezier/interpolate_batch", kNumT, [&] {
+      b.interpolate(&t[0], &out[0], kNumT);
+    });
+  }
+
+  void solve_benchmarks(Suite& suite)
+  {
+    const int kSizes[] = { 4, 16, 64, 256 };
+    CountingAllocator heap;
+    FrameArena arena(1 << 20);
+    for (int k = 0; k < (int)(sizeof(kSizes) / sizeof(kSizes[0])); ++k) {
+      const int n = kSizes[k];
+      // diagonally dominant, so it's well conditioned
+      Matrix2d<float> c(n, n + 1, &heap);
+      for (int i = 0; i < n; ++i) {
+        for (int j = 0; j <= n; ++j)
+          c.at(i, j) = frand(-1, 1);
+        c.at(i, i) += (float)n;
+      }
+      suite.run("matrix2d/gaussian_solve/" + to_string(n), 1, [&] {
+        Matrix2d<float> x(&heap);
+        gaussian_solve(c, &x);
+      });
+      suite.run("matrix2d/gaussian_solve_arena/" + to_string(n), 1, [&] {
+        arena.reset();
+        Matrix2d<float> x(&arena);
+        gaussian_solve(c, &x);
+      });
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Suite suite;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--json")) {
+      suite.format = kJson;
+    } else if (!strcmp(argv[i], "--csv")) {
+      suite.format = kCsv;
+    } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+      suite.filter = argv[++i];
+    } else if (!strcmp(argv[i], "--passes") && i + 1 < argc) {
+      suite.passes = max(1, atoi(argv[++i]));
+    } else {
+      fprintf(stderr, "usage: %s [--json | --csv] [--filter substring] [--passes n]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  thud_benchmarks(suite, Thud::Options(), "");
+  Thud::Options packed;
+  packed.packed_vertices = true;
+  thud_benchmarks(suite, packed, "_packed");
+  Thud::Options ring;
+  ring.ring_buffer = true;
+  thud_benchmarks(suite, ring, "_ring");
+  Thud::Options analytic;
+  analytic.analytic_shapes = true;
+  thud_benchmarks(suite, analytic, "_analytic");
+  to_clip_benchmarks(suite);
+  bezier_benchmarks(suite);
+  solve_benchmarks(suite);
+  suite.print();
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Micro benchmark for ScreenToClip, 1M vertices per pass.
+// Compares the old per-vertex to_clip (two divides per vertex) with the
+// precomputed scale/bias version, scalar and simd batches. The streaming run
+// transforms one 1M vertex array, which is mostly a test of memory bandwidth.
+// The cached run transforms a 4K vertex span 256 times. Each repetition
+// shifts src and dst by a few vertices and folds a vertex of the result into
+// a volatile, so the compiler can't drop the repeats, and the per-vertex
+// transforms are kept out of line, so they cost a call like they do in Thud.
+//
+//   g++ -O2 -mavx2 -mfma -I.. to_clip_bench.cpp ../screen_to_clip.cpp
+
+#include "../stdafx.h"
+#include "../screen_to_clip.hpp"
+#include <chrono>
+#include <vector>
+#include <stdlib.h>
+
+#if defined(_MSC_VER)
+#define THUD_NOINLINE __declspec(noinline)
+#elif defined(__GNUC__)
+#define THUD_NOINLINE __attribute__((noinline))
+#else
+#define THUD_NOINLINE
+#endif
+
+using namespace std;
+
+namespace
+{
+  const int kNumVerts = 1 << 20;
+  const int kSpanVerts = 4096;
+  const int kPasses = 20;
+  // how far the repetitions of the cached run move src and dst
+  const int kMaxShift = 8;
+
+  volatile float g_sink;
+
+  // the original ScreenToClip::to_clip
+  THUD_NOINLINE D3DXVECTOR2 to_clip_divide(const ScreenToClip& s, float x, float y)
+  {
+    return D3DXVECTOR2(
+      -s.clip_extents.x / 2 + 2 * x / s.screen_extents.x,
+      s.clip_extents.y / 2 - 2  * y / s.screen_extents.y);
+  }
+
+  THUD_NOINLINE D3DXVECTOR2 to_clip_scale_bias(const ScreenToClip& s, float x, float y)
+  {
+    return s.to_clip(x, y);
+  }
+
+  template<typename Fn>
+  double best_of(Fn fn)
+  {
+    double best = 1e30;
+    for (int i = 0; i < kPasses; ++i) {
+      const chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+      fn();
+      const chrono::duration<double> d = chrono::high_resolution_clock::now() - start;
+      best = min(best, d.count());
+    }
+    return best;
+  }
+
+  void report(const char *name, double secs)
+  {
+    printf("%-28s %8.3f ms %8.3f ns/vertex %8.1f Mvertex/s\n",
+      name, secs * 1e3, secs * 1e9 / kNumVerts, kNumVerts / secs * 1e-6);
+  }
+}
+
+int main()
+{
+  ScreenToClip s;
+  s.screen_extents = D3DXVECTOR2(1920, 1080);
+  s.pixel_extents = s.screen_extents;
+  s.update();
+
+  vector<D3DXVECTOR2> src(kNumVerts + kMaxShift), dst_storage(kNumVerts + 16 + kMaxShift);
+  // keep src and dst from sharing their low address bits, which would
+  // stall the loads on the previous stores (4K aliasing)
+  D3DXVECTOR2 *dst = &dst_storage[8];
+  for (int i = 0; i < kNumVerts + kMaxShift; ++i)
+    src[i] = D3DXVECTOR2((float)(rand() % 1920), (float)(rand() % 1080));
+
+  for (int run = 0; run < 2; ++run) {
+    // the same number of vertices either way
+    const int span = run == 0 ? kNumVerts : kSpanVerts;
+    const int reps = kNumVerts / span;
+    printf(run == 0 ? "streaming, 1M vertices\n" : "cached, 4K vertices x 256\n");
+
+    report("per vertex, divide", best_of([&]() {
+      for (int r = 0; r < reps; ++r) {
+        const D3DXVECTOR2 *in = &src[r % kMaxShift];
+        D3DXVECTOR2 *out = dst + r % kMaxShift;
+        for (int i = 0; i < span; ++i)
+          out[i] = to_clip_divide(s, in[i].x, in[i].y);
+        g_sink = out[r % span].x;
+      }
+    }));
+
+    report("per vertex, scale/bias", best_of([&]() {
+      for (int r = 0; r < reps; ++r) {
+        const D3DXVECTOR2 *in = &src[r % kMaxShift];
+        D3DXVECTOR2 *out = dst + r % kMaxShift;
+        for (int i = 0; i < span; ++i)
+          out[i] = to_clip_scale_bias(s, in[i].x, in[i].y);
+        g_sink = out[r % span].x;
+      }
+    }));
+
+    report("batch, scalar", best_of([&]() {
+      for (int r = 0; r < reps; ++r) {
+        D3DXVECTOR2 *out = dst + r % kMaxShift;
+        s.to_clip_scalar(&src[r % kMaxShift], out, span);
+        g_sink = out[r % span].x;
+      }
+    }));
+
+    report("batch, simd", best_of([&]() {
+      for (int r = 0; r < reps; ++r) {
+        D3DXVECTOR2 *out = dst + r % kMaxShift;
+        s.to_clip(&src[r % kMaxShift], out, span);
+        g_sink = out[r % span].x;
+      }
+    }));
+  }
+
+  // make sure the simd path agrees with the reference
+  float max_err = 0;
+  s.to_clip(&src[0], dst, kNumVerts);
+  for (int i = 0; i < kNumVerts; ++i) {
+    const D3DXVECTOR2 ref = to_clip_divide(s, src[i].x, src[i].y);
+    max_err = max(max_err, max(fabsf(ref.x - dst[i].x), fabsf(ref.y - dst[i].y)));
+  }
+  printf("max error vs divide: %g\n", max_err);
+  return 0;
+}
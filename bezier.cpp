@@ -0,0 +1,325 @@
+#include "stdafx.h"
+#include "bezier.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THUD_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+Bezier Bezier::from_points(AsArray<D3DXVECTOR3> points)
+{
+  const int n = points.size();
+  assert(n >= 2);
+  const D3DXVECTOR3 *d = points.data();
+
+  // Create a B-spline, and determine the control points that pass through
+  // the given points. The inner control points s[1..n-2] solve the
+  // tridiagonal 1-4-1 system
+  //
+  //   s[i-1] + 4 s[i] + s[i+1] = 6 d[i]
+  //
+  // with s[0] = d[0] and s[n-1] = d[n-1]. The Thomas algorithm solves it in
+  // one forward and one backward sweep, for all three coordinates at once,
+  // as they share the matrix.
+  vector<D3DXVECTOR3> s(n);
+  s[0] = d[0];
+  s[n-1] = d[n-1];
+
+  const int size = n - 2;
+  if (size > 0) {
+    // forward sweep. The modified super-diagonal is c[i] = 1 / (4 - c[i-1]),
+    // which converges to 2 - sqrt(3) within a few rows. Once it stops changing
+    // the rest of the rows use the last value, so c stays small and the sweep
+    // doesn't divide
+    vector<float> c;
+    c.reserve(32);
+    c.push_back(0.25f);
+    s[1] = (6 * d[1] - d[0]) * 0.25f;
+    bool converged = false;
+    for (int i = 1; i < size; ++i) {
+      if (!converged) {
+        const float ci = 1 / (4 - c.back());
+        converged = ci == c.back();
+        if (!converged)
+          c.push_back(ci);
+      }
+      const float ci = c.back();
+      D3DXVECTOR3 r = 6 * d[i+1];
+      if (i == size - 1)
+        r -= d[n-1];
+      s[i+1] = (r - s[i]) * ci;
+    }
+    // a single inner point also has the last point on the right hand side
+    if (size == 1)
+      s[1] -= d[n-1] * 0.25f;
+
+    // backward substitution
+    const int last = (int)c.size() - 1;
+    for (int i = size - 2; i >= 0; --i)
+      s[i+1] -= c[min(i, last)] * s[i+2];
+  }
+
+  Bezier b;
+  b.curves.reserve(n - 1);
+
+  // there are points-1 bezier curves, with the inner control points at the
+  // thirds of the b-spline control polygon
+  const float third = 1.0f / 3;
+  for (int i = 0; i < n - 1; ++i)
+    b.curves.push_back(ControlPoints(
+    d[i+0],
+    (2*s[i+0] + s[i+1]) * third,
+    (s[i+0] + 2*s[i+1]) * third,
+    d[i+1]));
+
+  b.update_coefficients();
+  return b;
+}
+
+D3DXVECTOR3 Bezier::interpolate(float t) const
+{
+  // clamp before converting, so huge t can't overflow the int
+  int ofs = (int)max(0.0f, min((float)(curves.size()-1), t));
+  t = max(0.0f, min(1.0f, t - ofs));
+
+  const ControlPoints& pts = curves[ofs];
+
+  const float tt = (1-t);
+  const float tt2 = tt*tt;
+  const float tt3 = tt2*tt;
+
+  const float t2 = t*t;
+  const float t3 = t2*t;
+
+  return tt3 * pts.p0 + 3 * tt2 * t * pts.p1 + 3 * tt * t2 * pts.p2 + t3 * pts.p3;
+}
+
+void Bezier::update_coefficients()
+{
+  const size_t n = curves.size();
+  _coefficients.resize(12 * n);
+  float *coeff = _coefficients.empty() ? nullptr : &_coefficients[0];
+  for (size_t i = 0; i < n; ++i) {
+    // expand the bernstein form into powers of t
+    const ControlPoints& pts = curves[i];
+    const D3DXVECTOR3 a = pts.p0;
+    const D3DXVECTOR3 b = 3 * (pts.p1 - pts.p0);
+    const D3DXVECTOR3 c = 3 * (pts.p0 - 2 * pts.p1 + pts.p2);
+    const D3DXVECTOR3 d = pts.p3 - pts.p0 + 3 * (pts.p1 - pts.p2);
+    const D3DXVECTOR3 *terms[] = { &a, &b, &c, &d };
+    for (int k = 0; k < 4; ++k) {
+      coeff[(3 * k + 0) * n + i] = terms[k]->x;
+      coeff[(3 * k + 1) * n + i] = terms[k]->y;
+      coeff[(3 * k + 2) * n + i] = terms[k]->z;
+    }
+  }
+}
+
+namespace
+{
+  D3DXVECTOR3 eval_scalar(const float *const *c, int seg, float t)
+  {
+    return D3DXVECTOR3(
+      ((c[9][seg] * t + c[6][seg]) * t + c[3][seg]) * t + c[0][seg],
+      ((c[10][seg] * t + c[7][seg]) * t + c[4][seg]) * t + c[1][seg],
+      ((c[11][seg] * t + c[8][seg]) * t + c[5][seg]) * t + c[2][seg]);
+  }
+
+#if defined(THUD_SSE2)
+  // horner, for 4 t values at once
+  inline __m128 horner(__m128 a, __m128 b, __m128 c, __m128 d, __m128 t)
+  {
+    return _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(d, t), c), t), b), t), a);
+  }
+
+  // writes the 4 points in x, y and z to out as 12 interleaved floats
+  inline void store_points(float *out, __m128 x, __m128 y, __m128 z)
+  {
+    __m128 w = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    // each store spills one float into the next point, which is then
+    // overwritten. The last point is stored without the spill
+    _mm_storeu_ps(out + 0, x);
+    _mm_storeu_ps(out + 3, y);
+    _mm_storeu_ps(out + 6, z);
+    _mm_storel_pi((__m64 *)(out + 9), w);
+    _mm_store_ss(out + 11, _mm_movehl_ps(w, w));
+  }
+#endif
+}
+
+void Bezier::interpolate(const float *t, D3DXVECTOR3 *out, int n) const
+{
+  assert(_coefficients.size() == 12 * curves.size() && !curves.empty());
+  const int segments = (int)curves.size();
+  const float *c[12];
+  for (int k = 0; k < 12; ++k)
+    c[k] = coefficients(k);
+
+  int i = 0;
+#if defined(THUD_SSE2)
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1);
+  const __m128 last = _mm_set1_ps((float)(segments - 1));
+  const __m128 end = _mm_set1_ps((float)segments);
+  for (; i + 4 <= n; i += 4) {
+    // segment = clamp((int)t, 0, segments-1), clamping t first so the
+    // conversion can't overflow
+    const __m128 vt = _mm_loadu_ps(t + i);
+    const __m128 clamped = _mm_min_ps(_mm_max_ps(vt, zero), end);
+    const __m128 seg = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(clamped)), last);
+    const __m128 local = _mm_min_ps(_mm_max_ps(_mm_sub_ps(vt, seg), zero), one);
+
+    int idx[4];
+    _mm_storeu_si128((__m128i *)idx, _mm_cvttps_epi32(seg));
+    __m128 k[12];
+    if (idx[0] == idx[3] && idx[1] == idx[0] && idx[2] == idx[0]) {
+      // the usual case for sorted t, all 4 in one segment
+      for (int j = 0; j < 12; ++j)
+        k[j] = _mm_set1_ps(c[j][idx[0]]);
+    } else {
+      for (int j = 0; j < 12; ++j)
+        k[j] = _mm_setr_ps(c[j][idx[0]], c[j][idx[1]], c[j][idx[2]], c[j][idx[3]]);
+    }
+
+    store_points(&out[i].x,
+      horner(k[0], k[3], k[6], k[9], local),
+      horner(k[1], k[4], k[7], k[10], local),
+      horner(k[2], k[5], k[8], k[11], local));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    // clamp before converting, so huge or NaN t can't overflow the int
+    const int seg = (int)max(0.0f, min((float)(segments - 1), t[i]));
+    out[i] = eval_scalar(c, seg, max(0.0f, min(1.0f, t[i] - seg)));
+  }
+}
+
+void Bezier::sample(int steps, D3DXVECTOR3 *out) const
+{
+  assert(_coefficients.size() == 12 * curves.size() && !curves.empty() && steps > 0);
+  const int segments = (int)curves.size();
+  const float *c[12];
+  for (int k = 0; k < 12; ++k)
+    c[k] = coefficients(k);
+
+  // horner at each t rather than forward differencing, which drifts in
+  // float at high step counts
+  const float inv_steps = 1.0f / steps;
+  for (int s = 0; s < segments; ++s) {
+    int j = 0;
+#if defined(THUD_SSE2)
+    __m128 k[12];
+    for (int m = 0; m < 12; ++m)
+      k[m] = _mm_set1_ps(c[m][s]);
+    const __m128 vinv = _mm_set1_ps(inv_steps);
+    __m128 vj = _mm_setr_ps(0, 1, 2, 3);
+    const __m128 four = _mm_set1_ps(4);
+    for (; j + 4 <= steps; j += 4) {
+      const __m128 t = _mm_mul_ps(vj, vinv);
+      store_points(&out[j].x,
+        horner(k[0], k[3], k[6], k[9], t),
+        horner(k[1], k[4], k[7], k[10], t),
+        horner(k[2], k[5], k[8], k[11], t));
+      vj = _mm_add_ps(vj, four);
+    }
+#endif
+    for (; j < steps; ++j)
+      out[j] = eval_scalar(c, s, j * inv_steps);
+    out += steps;
+  }
+
+  *out = curves.back().p3;
+}
+
+int Bezier::flatten_steps(int i, float tolerance) const
+{
+  // B''(t) = 6 * ((1-t)(p0 - 2 p1 + p2) + t(p1 - 2 p2 + p3)), which is
+  // linear in t, so the largest |B''| is at one of the ends
+  const ControlPoints& pts = curves[i];
+  const D3DXVECTOR3 d0 = pts.p0 - 2 * pts.p1 + pts.p2;
+  const D3DXVECTOR3 d1 = pts.p1 - 2 * pts.p2 + pts.p3;
+  const float m = 6 * sqrtf(max(d0.x*d0.x + d0.y*d0.y + d0.z*d0.z, d1.x*d1.x + d1.y*d1.y + d1.z*d1.z));
+
+  // past this, the tolerance is well below float precision anyway
+  const int kMaxSteps = 4096;
+  if (!(tolerance > 0))
+    return kMaxSteps;
+  const float n = ceilf(sqrtf(m / (8 * tolerance)));
+  return (int)max(1.0f, min((float)kMaxSteps, n));
+}
+
+void Bezier::flatten(float tolerance, std::vector<D3DXVECTOR3> *out) const
+{
+  assert(_coefficients.size() == 12 * curves.size() && !curves.empty());
+  const int segments = (int)curves.size();
+  const float *c[12];
+  for (int k = 0; k < 12; ++k)
+    c[k] = coefficients(k);
+
+  for (int s = 0; s < segments; ++s) {
+    const int steps = flatten_steps(s, tolerance);
+    const float inv_steps = 1.0f / steps;
+    for (int j = 0; j < steps; ++j)
+      out->push_back(eval_scalar(c, s, j * inv_steps));
+  }
+  out->push_back(curves.back().p3);
+}
+
+void ArcLengthTable::build(const Bezier& curve, int steps)
+{
+  assert(steps > 0 && !curve.curves.empty());
+  _steps = steps;
+  const int n = curve.num_samples(steps);
+  std::vector<D3DXVECTOR3> pts(n);
+  curve.sample(steps, &pts[0]);
+
+  _lengths.resize(n);
+  _lengths[0] = 0;
+  double total = 0;
+  for (int i = 1; i < n; ++i) {
+    const D3DXVECTOR3 d = pts[i] - pts[i-1];
+    total += sqrt(d.x*d.x + d.y*d.y + d.z*d.z);
+    _lengths[i] = (float)total;
+  }
+
+  const int num_cells = n - 1;
+  _cell_scale = total > 0 ? (float)(num_cells / total) : 0;
+  _cells.resize(num_cells + 1);
+  int j = 0;
+  for (int k = 0; k <= num_cells; ++k) {
+    const float start = _cell_scale > 0 ? k / _cell_scale : 0;
+    while (j + 1 < num_cells && _lengths[j+1] <= start)
+      ++j;
+    _cells[k] = j;
+  }
+}
+
+float ArcLengthTable::parameter(float s) const
+{
+  assert(!_cells.empty());
+  // find the chord j with lengths[j] <= s < lengths[j+1], starting from
+  // the cell s is in
+  const int last = (int)_lengths.size() - 2;
+  s = max(0.0f, min(length(), s));
+  const int cell = min((int)(s * _cell_scale), (int)_cells.size() - 1);
+  int j = _cells[cell];
+  while (j < last && _lengths[j+1] <= s)
+    ++j;
+
+  const float span = _lengths[j+1] - _lengths[j];
+  const float f = span > 0 ? (s - _lengths[j]) / span : 0;
+  return (j + f) / _steps;
+}
+
+void ArcLengthTable::parameters(const float *s, float *t, int n) const
+{
+  for (int i = 0; i < n; ++i)
+    t[i] = parameter(s[i]);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include "thud_types.hpp"
+
+// wrapper around a <data,size> tuple
+template<typename T>
+class AsArray
+{
+public:
+  AsArray(T* data, int n) : _data(data), _n(n) {}
+  int size() const { return _n; }
+  T *data() { return _data; }
+private:
+  T *_data;
+  int _n;
+};
+
+// A piecewise cubic Bezier curve, with one segment between each pair of
+// consecutive points. Segment i covers t in [i, i+1].
+struct Bezier
+{
+  // Create a Bezier curve that passes through all the given points, with C2
+  // continuity at the joins (a natural cubic spline). Needs at least 2 points.
+  // Runs in O(n) time and memory, so it's fine for millions of points
+  static Bezier from_points(AsArray<D3DXVECTOR3> points);
+
+  D3DXVECTOR3 interpolate(float t) const;
+
+  // Batch versions of interpolate. They read a structure-of-arrays copy of
+  // the curves in power basis, built by from_points, so call
+  // update_coefficients after changing curves by hand.
+  //
+  // evaluate n arbitrary t values, clamped like interpolate
+  void interpolate(const float *t, D3DXVECTOR3 *out, int n) const;
+  // steps evenly spaced points per segment, starting at t = i, followed by
+  // the end of the last segment, so out holds curves.size() * steps + 1 points
+  void sample(int steps, D3DXVECTOR3 *out) const;
+  int num_samples(int steps) const { return (int)curves.size() * steps + 1; }
+
+  void update_coefficients();
+
+  // Flattening. Segment i is split into n uniform steps, where n is the
+  // smallest count that keeps every chord within tolerance of the curve:
+  // a chord of a curve with |B''| <= M deviates at most M/(8n^2) from it,
+  // and for a cubic M is the largest of |B''(0)| and |B''(1)|. Tolerance is
+  // in the units of the control points.
+  int flatten_steps(int i, float tolerance) const;
+  // appends the polyline to out, with one point per step plus the end
+  void flatten(float tolerance, std::vector<D3DXVECTOR3> *out) const;
+
+  struct ControlPoints
+  {
+    ControlPoints(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, const D3DXVECTOR3& p2, const D3DXVECTOR3& p3) : p0(p0), p1(p1), p2(p2), p3(p3) {}
+    D3DXVECTOR3 p0, p1, p2, p3;
+  };
+
+  std::vector<ControlPoints> curves;
+
+private:
+  // p(t) = a + b*t + c*t^2 + d*t^3 for each segment, as 12 arrays of
+  // curves.size() floats, in the order ax, ay, az, bx, .. dz
+  const float *coefficients(int k) const { return &_coefficients[k * curves.size()]; }
+  std::vector<float> _coefficients;
+};
+
+// Maps distance along a Bezier to its parameter, for moving along it at
+// constant speed. The curve is sampled at steps points per segment, and the
+// distance between samples taken as the chord length, so lengths are a
+// little short on tightly bent segments, and within a chord t is linear in
+// the distance.
+//
+// Lookups go through a direct index over distance, with about one cell per
+// chord, so a lookup is O(1) unless the samples are very uneven in length.
+class ArcLengthTable
+{
+public:
+  ArcLengthTable() : _steps(1), _cell_scale(0) {}
+
+  // rebuild after changing the curve
+  void build(const Bezier& curve, int steps = 16);
+
+  float length() const { return _lengths.empty() ? 0 : _lengths.back(); }
+
+  // the t to pass to Bezier::interpolate for distance s, clamped to the
+  // ends of the curve
+  float parameter(float s) const;
+  void parameters(const float *s, float *t, int n) const;
+
+  // distance along the curve of each sample, sample i being at t = i / steps
+  const std::vector<float>& lengths() const { return _lengths; }
+  int steps() const { return _steps; }
+
+private:
+  int _steps;
+  // cells per unit of distance
+  float _cell_scale;
+  std::vector<float> _lengths;
+  // the last sample at or before the start of each cell
+  std::vector<int> _cells;
+};
@@ -0,0 +1,20 @@
+#include "stdafx.h"
+#include "circle_table.hpp"
+#include <assert.h>
+
+const D3DXVECTOR2 *CircleTables::build(int segments)
+{
+  assert(segments > 0);
+  if (segments >= (int)_tables.size())
+    _tables.resize(segments + 1);
+
+  std::vector<D3DXVECTOR2>& table = _tables[segments];
+  table.resize(segments + 1);
+  // compute the angles in double, so the last segments don't pick up
+  // the accumulated error of stepping by inc
+  const double inc = 2 * kPi / segments;
+  for (int i = 0; i < segments; ++i)
+    table[i] = D3DXVECTOR2((float)cos(i * inc), (float)sin(i * inc));
+  table[segments] = table[0];
+  return &table[0];
+}
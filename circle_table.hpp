@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+#include "thud_types.hpp"
+
+// Unit circle directions for a given segment count, built the first time a
+// count is asked for and shared by every circle that uses it. The table for n
+// segments has n+1 entries, with the last one equal to the first so the rim
+// can be walked without wrapping.
+class CircleTables
+{
+public:
+  const D3DXVECTOR2 *get(int segments)
+  {
+    if (segments < (int)_tables.size() && !_tables[segments].empty())
+      return &_tables[segments][0];
+    return build(segments);
+  }
+
+  void clear() { _tables.clear(); }
+
+private:
+  const D3DXVECTOR2 *build(int segments);
+
+  // indexed by segment count
+  std::vector<std::vector<D3DXVECTOR2> > _tables;
+};
@@ -0,0 +1,28 @@
+#include "stdafx.h"
+#include "console.hpp"
+#include <stdarg.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#endif
+
+void console_printf(const char *fmt, ...)
+{
+  va_list arg;
+  va_start(arg, fmt);
+
+#ifdef _WIN32
+  // measuring consumes the va_list, so format from a copy
+  va_list copy;
+  va_copy(copy, arg);
+  const int len = _vscprintf(fmt, copy) + 1;
+  va_end(copy);
+  char* buf = (char*)_alloca(len);
+  vsprintf_s(buf, len, fmt, arg);
+  OutputDebugStringA(buf);
+#else
+  vfprintf(stderr, fmt, arg);
+#endif
+
+  va_end(arg);
+}
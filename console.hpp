@@ -0,0 +1,4 @@
+#pragma once
+
+// printf to the debugger output window, or stderr where there is none
+void console_printf(const char *fmt, ...);
@@ -0,0 +1,40 @@
+#include "stdafx.h"
+#include "cull.hpp"
+
+bool clip_segment(const Bounds& b, D3DXVECTOR3 *p0, D3DXVECTOR3 *p1)
+{
+  // p(t) = p0 + t * d for t in [0, 1] is inside edge i when t * p[i] <= q[i],
+  // so the segment enters the box at t = q[i] / p[i] where p[i] < 0, and
+  // leaves it where p[i] > 0
+  const D3DXVECTOR3 d = *p1 - *p0;
+  const float p[] = { -d.x, d.x, -d.y, d.y };
+  const float q[] = { p0->x - b.lo.x, b.hi.x - p0->x, p0->y - b.lo.y, b.hi.y - p0->y };
+  float t0 = 0, t1 = 1;
+  for (int i = 0; i < 4; ++i) {
+    if (p[i] == 0) {
+      // parallel to the edge, so either all outside or nothing to clip
+      if (q[i] < 0)
+        return false;
+      continue;
+    }
+    const float t = q[i] / p[i];
+    if (p[i] < 0) {
+      if (t > t1)
+        return false;
+      if (t > t0)
+        t0 = t;
+    } else {
+      if (t < t0)
+        return false;
+      if (t < t1)
+        t1 = t;
+    }
+  }
+
+  const D3DXVECTOR3 start = *p0;
+  if (t1 < 1)
+    *p1 = start + t1 * d;
+  if (t0 > 0)
+    *p0 = start + t0 * d;
+  return true;
+}
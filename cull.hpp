@@ -0,0 +1,57 @@
+#pragma once
+
+#include "thud_types.hpp"
+
+// An axis aligned box in screen space, used to reject primitives, and clip
+// the ones that are only partly inside, before they are tessellated
+struct Bounds
+{
+  Bounds() {}
+  Bounds(const D3DXVECTOR2& lo, const D3DXVECTOR2& hi) : lo(lo), hi(hi) {}
+
+  // the box spanned by two corners, in any order
+  static Bounds corners(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+  {
+    return Bounds(
+      D3DXVECTOR2(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y),
+      D3DXVECTOR2(a.x < b.x ? b.x : a.x, a.y < b.y ? b.y : a.y));
+  }
+
+  Bounds expand(float r) const
+  {
+    return Bounds(D3DXVECTOR2(lo.x - r, lo.y - r), D3DXVECTOR2(hi.x + r, hi.y + r));
+  }
+
+  Bounds intersect(const Bounds& b) const
+  {
+    return Bounds(
+      D3DXVECTOR2(lo.x > b.lo.x ? lo.x : b.lo.x, lo.y > b.lo.y ? lo.y : b.lo.y),
+      D3DXVECTOR2(hi.x < b.hi.x ? hi.x : b.hi.x, hi.y < b.hi.y ? hi.y : b.hi.y));
+  }
+
+  void add(const D3DXVECTOR3& p)
+  {
+    lo.x = p.x < lo.x ? p.x : lo.x;
+    lo.y = p.y < lo.y ? p.y : lo.y;
+    hi.x = p.x > hi.x ? p.x : hi.x;
+    hi.y = p.y > hi.y ? p.y : hi.y;
+  }
+
+  // touching edges don't count, as there is nothing to draw there
+  bool overlaps(const Bounds& b) const
+  {
+    return lo.x < b.hi.x && b.lo.x < hi.x && lo.y < b.hi.y && b.lo.y < hi.y;
+  }
+
+  bool contains(const Bounds& b) const
+  {
+    return lo.x <= b.lo.x && b.hi.x <= hi.x && lo.y <= b.lo.y && b.hi.y <= hi.y;
+  }
+
+  D3DXVECTOR2 lo;
+  D3DXVECTOR2 hi;
+};
+
+// Liang-Barsky. Clips the segment p0 -> p1 to b, interpolating z along it.
+// Returns false if none of it is inside
+bool clip_segment(const Bounds& b, D3DXVECTOR3 *p0, D3DXVECTOR3 *p1);
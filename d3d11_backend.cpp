@@ -0,0 +1,490 @@
+#include "stdafx.h"
+#include "d3d11_backend.hpp"
+#include "packed_vertex.hpp"
+#include <celsus/graphics.hpp>
+#include <celsus/error2.hpp>
+#include <celsus/effect_wrapper.hpp>
+
+char shader[] = " "\
+"float4 scale; 											  "\
+"float4 bias; 											  "\
+"float4 screen_to_clip;								"\
+"struct psInput												"\
+"{																		"\
+"	float4 pos : SV_Position;						"\
+"	float4 col : Color;									"\
+"};																		"\
+"																			"\
+"struct vsInput												"\
+"{																		"\
+"	float4 pos : SV_Position;						"\
+"	float4 col : Color;									"\
+"};																		"\
+"psInput vsMain(in vsInput v)					"\
+"{																		"\
+"	psInput o = (psInput)0;							"\
+"	o.pos = v.pos * scale + bias;	  "\
+"	o.col = v.col;											"\
+"	return o;														"\
+"}																		"\
+"																			"\
+"float4 psMain(in psInput v) : SV_Target	"\
+"{"\
+"	return v.col;"\
+"}";
+
+// Expands RectInstance and LineInstance records (see instances.hpp) into the
+// same triangles Thud::rect and Thud::line write. Uses psMain from above.
+// ShapeInstances become a quad a pixel bigger than the shape, and psShape
+// works out the coverage from the distance to the outline, in pixels, the
+// same as shape_distance and shape_coverage
+char instance_shader[] =
+"cbuffer Frame : register(b0)\n"
+"{\n"
+"  float4 scale;\n"
+"  float4 bias;\n"
+"  float4 screen_to_clip;\n"
+"  float4 packed;\n"
+"  float4 pixel_size;\n"
+"};\n"
+"cbuffer Draw : register(b1)\n"
+"{\n"
+"  // x the first instance, y 1 if the draw blends\n"
+"  uint4 first_instance;\n"
+"};\n"
+"struct psInput\n"
+"{\n"
+"  float4 pos : SV_Position;\n"
+"  float4 col : Color;\n"
+"};\n"
+"struct Rect { float2 pos; float2 size; float z; uint col; };\n"
+"struct Line { float2 p0; float2 p1; float w; float z; uint col; };\n"
+"StructuredBuffer<Rect> rects : register(t0);\n"
+"StructuredBuffer<Line> lines : register(t1);\n"
+"struct Shape { float2 centre; float2 radii; float corner; float z; uint col; };\n"
+"StructuredBuffer<Shape> shapes : register(t2);\n"
+"float4 unpack_col(uint c)\n"
+"{\n"
+"  return float4((c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff, c >> 24) / 255.0;\n"
+"}\n"
+"psInput output(float2 p, float z, uint col)\n"
+"{\n"
+"  psInput o;\n"
+"  o.pos = float4(p * screen_to_clip.xy + screen_to_clip.zw, z, 1);\n"
+"  o.col = unpack_col(col);\n"
+"  return o;\n"
+"}\n"
+"psInput vsRect(uint vtx : SV_VertexID, uint inst : SV_InstanceID)\n"
+"{\n"
+"  static const float2 corners[6] = { float2(0,0), float2(1,0), float2(0,1), float2(0,1), float2(1,0), float2(1,1) };\n"
+"  Rect r = rects[inst + first_instance.x];\n"
+"  return output(r.pos + r.size * corners[vtx], r.z, r.col);\n"
+"}\n"
+"psInput vsLine(uint vtx : SV_VertexID, uint inst : SV_InstanceID)\n"
+"{\n"
+"  static const float along[6] = { 0, 0, 1, 0, 1, 1 };\n"
+"  static const float side[6] = { 1, -1, 1, -1, -1, 1 };\n"
+"  Line l = lines[inst + first_instance.x];\n"
+"  float2 d = l.p1 - l.p0;\n"
+"  float len = length(d);\n"
+"  float2 n = len > 0 ? float2(-d.y, d.x) * (0.5 * l.w / len) : float2(0, 0);\n"
+"  return output(l.p0 + along[vtx] * d + side[vtx] * n, l.z, l.col);\n"
+"}\n"
+"float4 psMain(in psInput v) : SV_Target\n"
+"{\n"
+"  return v.col;\n"
+"}\n"
+"struct shapeInput\n"
+"{\n"
+"  float4 pos : SV_Position;\n"
+"  float4 col : Color;\n"
+"  float2 p : Offset;\n"
+"  nointerpolation float3 shape : Shape;\n"
+"};\n"
+"shapeInput vsShape(uint vtx : SV_VertexID, uint inst : SV_InstanceID)\n"
+"{\n"
+"  static const float2 corners[6] = { float2(-1,-1), float2(1,-1), float2(-1,1), float2(-1,1), float2(1,-1), float2(1,1) };\n"
+"  Shape s = shapes[inst + first_instance.x];\n"
+"  float2 offset = (s.radii + pixel_size.xy) * corners[vtx];\n"
+"  psInput o = output(s.centre + offset, s.z, s.col);\n"
+"  shapeInput r;\n"
+"  r.pos = o.pos;\n"
+"  r.col = o.col;\n"
+"  r.p = offset / pixel_size.xy;\n"
+"  r.shape = float3(s.radii / pixel_size.xy, s.corner < 0 ? -1 : s.corner * 2 / (pixel_size.x + pixel_size.y));\n"
+"  return r;\n"
+"}\n"
+"float shape_distance(float2 p, float2 radii, float corner)\n"
+"{\n"
+"  if (corner < 0) {\n"
+"    float k1 = length(p / radii);\n"
+"    float k2 = length(p / (radii * radii));\n"
+"    return k2 > 0 ? k1 * (k1 - 1) / k2 : -min(radii.x, radii.y);\n"
+"  }\n"
+"  float2 q = abs(p) - radii + corner;\n"
+"  return length(max(q, 0)) + min(max(q.x, q.y), 0) - corner;\n"
+"}\n"
+"float4 psShape(in shapeInput v) : SV_Target\n"
+"{\n"
+"  float d = shape_distance(v.p, v.shape.xy, v.shape.z);\n"
+"  float coverage = first_instance.y ? saturate(0.5 - d) : (d <= 0 ? 1 : 0);\n"
+"  if (coverage <= 0)\n"
+"    discard;\n"
+"  return float4(v.col.rgb, v.col.a * coverage);\n"
+"}\n";
+
+// PackedVertex, see packed_vertex.hpp. The input layout does the snorm and
+// unorm conversions, which leaves mapping the position back out of the
+// packed range
+char packed_shader[] =
+"cbuffer Frame : register(b0)\n"
+"{\n"
+"  float4 scale;\n"
+"  float4 bias;\n"
+"  float4 screen_to_clip;\n"
+"  float4 packed;\n"
+"};\n"
+"struct psInput\n"
+"{\n"
+"  float4 pos : SV_Position;\n"
+"  float4 col : Color;\n"
+"};\n"
+"struct vsInput\n"
+"{\n"
+"  float2 pos : Position;\n"
+"  float4 col : Color;\n"
+"  float z : Depth;\n"
+"};\n"
+"psInput vsPacked(in vsInput v)\n"
+"{\n"
+"  psInput o;\n"
+"  o.pos = float4(v.pos * packed.xy + packed.zw, v.z, 1) * scale + bias;\n"
+"  o.col = v.col;\n"
+"  return o;\n"
+"}\n"
+"float4 psMain(in psInput v) : SV_Target\n"
+"{\n"
+"  return v.col;\n"
+"}\n";
+
+namespace
+{
+  // A dynamic D3D11 buffer that is written with map(WRITE_DISCARD or
+  // WRITE_NO_OVERWRITE), or a static one in default memory that is written
+  // with UpdateSubresource
+  struct D3D11Sink : public VertexSink
+  {
+    D3D11Sink(int stride, int capacity)
+      : _stride(stride)
+      , _capacity(capacity)
+      , _begin(nullptr)
+    {
+    }
+
+    bool create(ID3D11Device *device, UINT bind_flags, bool is_static)
+    {
+      D3D11_BUFFER_DESC desc;
+      ZeroMemory(&desc, sizeof(desc));
+      desc.ByteWidth = _stride * _capacity;
+      desc.Usage = is_static ? D3D11_USAGE_DEFAULT : D3D11_USAGE_DYNAMIC;
+      desc.BindFlags = bind_flags;
+      desc.CPUAccessFlags = is_static ? 0 : D3D11_CPU_ACCESS_WRITE;
+      if (bind_flags & D3D11_BIND_SHADER_RESOURCE) {
+        desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+        desc.StructureByteStride = _stride;
+      }
+      if (FAILED(device->CreateBuffer(&desc, NULL, &buffer.p)))
+        return false;
+
+      if (bind_flags & D3D11_BIND_SHADER_RESOURCE) {
+        D3D11_SHADER_RESOURCE_VIEW_DESC view;
+        ZeroMemory(&view, sizeof(view));
+        view.Format = DXGI_FORMAT_UNKNOWN;
+        view.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+        view.Buffer.FirstElement = 0;
+        view.Buffer.NumElements = _capacity;
+        if (FAILED(device->CreateShaderResourceView(buffer, &view, &srv.p)))
+          return false;
+      }
+      return true;
+    }
+
+    virtual void *map(MapMode mode)
+    {
+      D3D11_MAPPED_SUBRESOURCE res;
+      const D3D11_MAP type = mode == kMapNoOverwrite ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD;
+      if (FAILED(Graphics::instance().context()->Map(buffer, 0, type, 0, &res)))
+        return nullptr;
+      return _begin = (char *)res.pData;
+    }
+
+    virtual int unmap(void *end)
+    {
+      Graphics::instance().context()->Unmap(buffer, 0);
+      const int count = (int)((char *)end - _begin) / _stride;
+      _begin = nullptr;
+      return count;
+    }
+
+    virtual int stride() const { return _stride; }
+    virtual int capacity() const { return _capacity; }
+
+    CComPtr<ID3D11Buffer> buffer;
+    // only for instance sinks
+    CComPtr<ID3D11ShaderResourceView> srv;
+
+  private:
+    int _stride;
+    int _capacity;
+    char *_begin;
+  };
+
+  // an event query, which the GPU signals when it gets to it
+  struct D3D11Fence : public Fence
+  {
+    bool create(ID3D11Device *device)
+    {
+      D3D11_QUERY_DESC desc;
+      ZeroMemory(&desc, sizeof(desc));
+      desc.Query = D3D11_QUERY_EVENT;
+      return SUCCEEDED(device->CreateQuery(&desc, &query.p));
+    }
+
+    virtual void insert()
+    {
+      Graphics::instance().context()->End(query.p);
+    }
+
+    virtual bool passed()
+    {
+      // polling mustn't flush the commands, Present does that
+      BOOL done = FALSE;
+      return Graphics::instance().context()->GetData(query.p, &done, sizeof(done), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK && done;
+    }
+
+    CComPtr<ID3D11Query> query;
+  };
+}
+
+namespace
+{
+  HRESULT create_blend_state(ID3D11Device *device, D3D11_BLEND src, D3D11_BLEND dst, ID3D11BlendState **state)
+  {
+    D3D11_BLEND_DESC desc;
+    ZeroMemory(&desc, sizeof(desc));
+    D3D11_RENDER_TARGET_BLEND_DESC& rt = desc.RenderTarget[0];
+    rt.BlendEnable = TRUE;
+    rt.SrcBlend = src;
+    rt.DestBlend = dst;
+    rt.BlendOp = D3D11_BLEND_OP_ADD;
+    rt.SrcBlendAlpha = D3D11_BLEND_ONE;
+    rt.DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
+    rt.BlendOpAlpha = D3D11_BLEND_OP_ADD;
+    rt.RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+    return device->CreateBlendState(&desc, state);
+  }
+}
+
+D3D11Backend::D3D11Backend()
+  : _effect(nullptr)
+  , _packed_effect(nullptr)
+  , _blend(kBlendDefault)
+{
+  for (int i = 0; i < kNumInstanceKinds; ++i)
+    _instance_effects[i] = nullptr;
+}
+
+bool D3D11Backend::init()
+{
+	_effect = new EffectWrapper();
+	RETURN_ON_FAIL_BOOL_E(_effect->load_shaders(shader, sizeof(shader), "vsMain", NULL, "psMain"));
+
+	RETURN_ON_FAIL_BOOL_E(InputDesc().
+		add("SV_POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0).
+		add("COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12).
+		create(_layout, _effect));
+
+  _packed_effect = new EffectWrapper();
+  RETURN_ON_FAIL_BOOL_E(_packed_effect->load_shaders(packed_shader, sizeof(packed_shader), "vsPacked", NULL, "psMain"));
+  RETURN_ON_FAIL_BOOL_E(InputDesc().
+    add("POSITION", 0, DXGI_FORMAT_R16G16_SNORM, 0).
+    add("COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 4).
+    add("DEPTH", 0, DXGI_FORMAT_R16_UNORM, 0, 8).
+    create(_packed_layout, _packed_effect));
+
+  _instance_effects[kRectInstance] = new EffectWrapper();
+  RETURN_ON_FAIL_BOOL_E(_instance_effects[kRectInstance]->load_shaders(instance_shader, sizeof(instance_shader), "vsRect", NULL, "psMain"));
+  _instance_effects[kLineInstance] = new EffectWrapper();
+  RETURN_ON_FAIL_BOOL_E(_instance_effects[kLineInstance]->load_shaders(instance_shader, sizeof(instance_shader), "vsLine", NULL, "psMain"));
+  _instance_effects[kShapeInstance] = new EffectWrapper();
+  RETURN_ON_FAIL_BOOL_E(_instance_effects[kShapeInstance]->load_shaders(instance_shader, sizeof(instance_shader), "vsShape", NULL, "psShape"));
+
+  RETURN_ON_FAIL_BOOL_E(create_cbuffer(Graphics::instance().device(), sizeof(FrameConstants), &_cbuffer.p));
+  RETURN_ON_FAIL_BOOL_E(create_cbuffer(Graphics::instance().device(), 4 * sizeof(UINT), &_draw_cbuffer.p));
+
+  ID3D11Device *device = Graphics::instance().device();
+  RETURN_ON_FAIL_BOOL_E(create_blend_state(device, D3D11_BLEND_SRC_ALPHA, D3D11_BLEND_INV_SRC_ALPHA, &_blend_states[kBlendAlpha].p));
+  RETURN_ON_FAIL_BOOL_E(create_blend_state(device, D3D11_BLEND_SRC_ALPHA, D3D11_BLEND_ONE, &_blend_states[kBlendAdditive].p));
+
+  return true;
+}
+
+void D3D11Backend::close()
+{
+	SAFE_DELETE(_effect);
+  SAFE_DELETE(_packed_effect);
+  for (int i = 0; i < kNumInstanceKinds; ++i)
+    SAFE_DELETE(_instance_effects[i]);
+}
+
+D3DXVECTOR2 D3D11Backend::extents() const
+{
+  return D3DXVECTOR2((float)Graphics::instance().width(), (float)Graphics::instance().height());
+}
+
+VertexSink *D3D11Backend::create_sink(UINT bind_flags, int stride, int capacity, bool is_static)
+{
+  D3D11Sink *sink = new D3D11Sink(stride, capacity);
+  if (!sink->create(Graphics::instance().device(), bind_flags, is_static)) {
+    delete sink;
+    return nullptr;
+  }
+  return sink;
+}
+
+VertexSink *D3D11Backend::create_vertex_sink(int stride, int capacity)
+{
+  return create_sink(D3D11_BIND_VERTEX_BUFFER, stride, capacity);
+}
+
+VertexSink *D3D11Backend::create_index_sink(int stride, int capacity)
+{
+  return create_sink(D3D11_BIND_INDEX_BUFFER, stride, capacity);
+}
+
+VertexSink *D3D11Backend::create_instance_sink(int stride, int capacity)
+{
+  // read by the vertex shader as a StructuredBuffer
+  return create_sink(D3D11_BIND_SHADER_RESOURCE, stride, capacity);
+}
+
+VertexSink *D3D11Backend::create_static_vertex_sink(int stride, int capacity)
+{
+  return create_sink(D3D11_BIND_VERTEX_BUFFER, stride, capacity, true);
+}
+
+VertexSink *D3D11Backend::create_static_index_sink(int stride, int capacity)
+{
+  return create_sink(D3D11_BIND_INDEX_BUFFER, stride, capacity, true);
+}
+
+void D3D11Backend::update(VertexSink *sink, int first, const void *data, int count)
+{
+  if (count <= 0)
+    return;
+  // only the range is copied, the rest of the buffer is left alone
+  D3D11_BOX box;
+  box.left = first * sink->stride();
+  box.right = (first + count) * sink->stride();
+  box.top = box.front = 0;
+  box.bottom = box.back = 1;
+  Graphics::instance().context()->UpdateSubresource(static_cast<D3D11Sink *>(sink)->buffer, 0, &box, data, 0, 0);
+}
+
+Fence *D3D11Backend::create_fence()
+{
+  D3D11Fence *fence = new D3D11Fence();
+  if (!fence->create(Graphics::instance().device())) {
+    delete fence;
+    return nullptr;
+  }
+  return fence;
+}
+
+void D3D11Backend::start_frame(const FrameConstants& constants)
+{
+  set_constants(constants);
+  _blend = kBlendDefault;
+}
+
+void D3D11Backend::set_constants(const FrameConstants& constants)
+{
+  ID3D11DeviceContext* context = Graphics::instance().context();
+
+  // set the cbuffer
+  *(FrameConstants *)map_buffer(context, _cbuffer) = constants;
+  unmap_buffer(context, _cbuffer);
+  context->VSSetConstantBuffers(0, 1, &_cbuffer.p);
+}
+
+void D3D11Backend::set_blend(BlendMode mode)
+{
+  _blend = mode;
+}
+
+void D3D11Backend::set_states()
+{
+  Graphics& graphics = Graphics::instance();
+  ID3D11DeviceContext* context = graphics.context();
+
+  context->OMSetDepthStencilState(graphics.default_dss(), graphics.default_stencil_ref());
+  ID3D11BlendState *blend = _blend == kBlendDefault ? graphics.default_blend_state() : _blend_states[_blend].p;
+  context->OMSetBlendState(blend, graphics.default_blend_factors(), graphics.default_sample_mask());
+}
+
+void D3D11Backend::set_pipeline(VertexSink *verts)
+{
+  ID3D11DeviceContext* context = Graphics::instance().context();
+  set_states();
+
+  // the arenas only use the two vertex formats
+  const bool packed = verts->stride() == sizeof(PackedVertex);
+  (packed ? _packed_effect : _effect)->set_shaders(context);
+  context->IASetInputLayout(packed ? _packed_layout : _layout);
+  set_vb(context, static_cast<D3D11Sink *>(verts)->buffer, verts->stride());
+  context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+void D3D11Backend::draw(VertexSink *sink, int first, int count)
+{
+  set_pipeline(sink);
+  Graphics::instance().context()->Draw(count, first);
+}
+
+void D3D11Backend::draw_indexed(VertexSink *verts, VertexSink *indices, int first, int count, int base_vertex)
+{
+  ID3D11DeviceContext* context = Graphics::instance().context();
+  set_pipeline(verts);
+  const DXGI_FORMAT fmt = indices->stride() == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+  context->IASetIndexBuffer(static_cast<D3D11Sink *>(indices)->buffer, fmt, 0);
+  context->DrawIndexed(count, first, base_vertex);
+}
+
+void D3D11Backend::draw_instanced(InstanceKind kind, VertexSink *instances, int first, int count)
+{
+  ID3D11DeviceContext* context = Graphics::instance().context();
+  set_states();
+
+  // SV_InstanceID always starts at 0, so the offset goes in a cbuffer
+  UINT *params = (UINT *)map_buffer(context, _draw_cbuffer);
+  params[0] = first;
+  // psShape only antialiases when the alpha is used
+  params[1] = _blend != kBlendDefault;
+  params[2] = params[3] = 0;
+  unmap_buffer(context, _draw_cbuffer);
+  ID3D11Buffer *cbuffers[] = { _cbuffer, _draw_cbuffer };
+  context->VSSetConstantBuffers(0, 2, cbuffers);
+  if (kind == kShapeInstance)
+    context->PSSetConstantBuffers(0, 2, cbuffers);
+
+  _instance_effects[kind]->set_shaders(context);
+  // rects are in t0, lines in t1 and shapes in t2
+  context->VSSetShaderResources(kind, 1, &static_cast<D3D11Sink *>(instances)->srv.p);
+  // the vertices come from SV_VertexID, so there's no input layout
+  context->IASetInputLayout(NULL);
+  context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+  context->DrawInstanced(6, count, 0, 0);
+
+  ID3D11ShaderResourceView *null_srv = NULL;
+  context->VSSetShaderResources(kind, 1, &null_srv);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "backend.hpp"
+#include <atlbase.h>
+#include <d3d11.h>
+
+class EffectWrapper;
+
+struct D3D11Backend : public Backend
+{
+  D3D11Backend();
+
+  virtual bool init();
+  virtual void close();
+
+  virtual D3DXVECTOR2 extents() const;
+
+  virtual VertexSink *create_vertex_sink(int stride, int capacity);
+  virtual VertexSink *create_index_sink(int stride, int capacity);
+  virtual VertexSink *create_instance_sink(int stride, int capacity);
+  virtual VertexSink *create_static_vertex_sink(int stride, int capacity);
+  virtual VertexSink *create_static_index_sink(int stride, int capacity);
+  virtual void update(VertexSink *sink, int first, const void *data, int count);
+  virtual Fence *create_fence();
+
+  virtual void start_frame(const FrameConstants& constants);
+  virtual void set_constants(const FrameConstants& constants);
+  virtual void set_blend(BlendMode mode);
+  virtual void draw(VertexSink *sink, int first, int count);
+  virtual void draw_indexed(VertexSink *verts, VertexSink *indices, int first, int count, int base_vertex);
+  virtual void draw_instanced(InstanceKind kind, VertexSink *instances, int first, int count);
+
+private:
+  VertexSink *create_sink(UINT bind_flags, int stride, int capacity, bool is_static = false);
+  void set_states();
+  void set_pipeline(VertexSink *verts);
+
+  EffectWrapper *_effect;
+  EffectWrapper *_packed_effect;
+  EffectWrapper *_instance_effects[kNumInstanceKinds];
+  CComPtr<ID3D11InputLayout> _layout;
+  CComPtr<ID3D11InputLayout> _packed_layout;
+  CComPtr<ID3D11Buffer> _cbuffer;
+  // first instance of the current draw_instanced
+  CComPtr<ID3D11Buffer> _draw_cbuffer;
+  // kBlendDefault uses the one from Graphics
+  CComPtr<ID3D11BlendState> _blend_states[kNumBlendModes];
+  BlendMode _blend;
+};
@@ -0,0 +1,94 @@
+#include "stdafx.h"
+#include "draw_list.hpp"
+#include <algorithm>
+#include <assert.h>
+
+using namespace std;
+
+uint32_t DrawList::make_key(const DrawCommand& cmd)
+{
+  const float z = min(1.0f, max(0.0f, cmd.p0.z));
+  const uint32_t depth = (uint32_t)(z * 65535 + 0.5f);
+  const uint32_t state = (uint32_t)cmd.canvas << 24 | (uint32_t)cmd.blend << 22;
+  if (cmd.blend == kBlendAlpha)
+    return state | (0xffff - depth) << 2 | cmd.pipeline;
+  return state | (uint32_t)cmd.pipeline << 16 | depth;
+}
+
+void DrawList::clear()
+{
+  _commands.clear();
+  _order.clear();
+  _points.clear();
+}
+
+void DrawList::add(const DrawCommand& cmd)
+{
+  assert(cmd.blend < 4 && cmd.pipeline < kNumPipelines);
+  SortItem item;
+  item.key = make_key(cmd);
+  item.index = (uint32_t)_commands.size();
+  _commands.push_back(cmd);
+  _order.push_back(item);
+}
+
+int DrawList::add_points(const D3DXVECTOR3 *pts, int n)
+{
+  const int first = (int)_points.size();
+  _points.insert(_points.end(), pts, pts + n);
+  return first;
+}
+
+void DrawList::sort()
+{
+  // lsd radix sort, 8 bits per pass. Each pass is stable, so the whole sort is
+  const size_t n = _order.size();
+  if (n < 2)
+    return;
+  _scratch.resize(n);
+  SortItem *src = &_order[0];
+  SortItem *dst = &_scratch[0];
+
+  for (int shift = 0; shift < 32; shift += 8) {
+    size_t offsets[256] = { 0 };
+    for (size_t i = 0; i < n; ++i)
+      ++offsets[(src[i].key >> shift) & 0xff];
+    // all the keys agree on this byte, so the pass wouldn't move anything.
+    // With one canvas and one blend mode that skips the top byte
+    if (offsets[(src[0].key >> shift) & 0xff] == n)
+      continue;
+
+    size_t sum = 0;
+    for (int b = 0; b < 256; ++b) {
+      const size_t count = offsets[b];
+      offsets[b] = sum;
+      sum += count;
+    }
+    for (size_t i = 0; i < n; ++i)
+      dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+    swap(src, dst);
+  }
+
+  if (src != &_order[0])
+    _order.swap(_scratch);
+}
+
+int DrawList::count_draws(bool sorted) const
+{
+  // every canvas has its own arena per pipeline, and each arena starts a new
+  // draw when the blend mode changes. last holds the mode of the last command
+  // that went to each arena
+  vector<int> last;
+  int draws = 0;
+  for (size_t i = 0; i < _commands.size(); ++i) {
+    const DrawCommand& cmd = sorted ? _commands[_order[i].index] : _commands[i];
+    const size_t arena = cmd.canvas * kNumPipelines + cmd.pipeline;
+    if (arena >= last.size())
+      last.resize(arena + 1, -1);
+    if (last[arena] != cmd.blend) {
+      last[arena] = cmd.blend;
+      ++draws;
+    }
+  }
+  return draws;
+}
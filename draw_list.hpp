@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "backend.hpp"
+
+enum CommandKind
+{
+  kCircleCommand,
+  kRectCommand,
+  kLineCommand,
+  kPolylineCommand,
+  kEllipseCommand,
+  kRoundedRectCommand,
+};
+
+// the arena a command's vertices go to. Commands in different pipelines never
+// share a draw, whatever their other state
+enum Pipeline
+{
+  kTrianglePipeline,
+  kRectPipeline,
+  kLinePipeline,
+  // circles, ellipses and rounded rects as ShapeInstances
+  kShapePipeline,
+  kNumPipelines
+};
+
+// a primitive, with the state it was submitted with
+struct DrawCommand
+{
+  uint8_t kind;
+  uint8_t pipeline;
+  uint8_t blend;
+  uint8_t canvas;
+  // polylines only, a LineJoin
+  uint8_t join;
+  // circle, ellipse or rounded rect segments, or polyline point count
+  int segments;
+  // polylines only, the first point in DrawList::points
+  int first;
+  // circle, ellipse or rounded rect centre, rect top left, line or polyline
+  // start
+  D3DXVECTOR3 p0;
+  // rect size, line end, or ellipse or rounded rect radii
+  D3DXVECTOR3 p1;
+  // circle radius, line width or corner radius
+  float w;
+  D3DXCOLOR col;
+};
+
+// A frame's worth of commands, recorded so they can be reordered before they
+// are written to the canvas.
+//
+// The sort key is, from the top bit down, canvas, blend, then pipeline and
+// 16 bit depth. Alpha blending depends on draw order, so for kBlendAlpha depth
+// comes before pipeline and runs back to front (large z first), for the other
+// modes the depth test sorts things out, and depth runs front to back to help
+// early z. The sort is stable, so commands with equal keys keep the order they
+// were submitted in.
+class DrawList
+{
+public:
+  void clear();
+  void add(const DrawCommand& cmd);
+  // copies the points of a polyline, and returns where they start
+  int add_points(const D3DXVECTOR3 *pts, int n);
+  const D3DXVECTOR3 *points(int first) const { return &_points[first]; }
+  // radix sort on the keys
+  void sort();
+
+  int size() const { return (int)_order.size(); }
+  // the i-th command in sorted order, or submission order before sort()
+  const DrawCommand& operator[](int i) const { return _commands[_order[i].index]; }
+
+  // draws the commands need, one per change of blend mode in each canvas and
+  // pipeline. Ignores chunk boundaries, which cost the same either way
+  int count_draws(bool sorted) const;
+
+  static uint32_t make_key(const DrawCommand& cmd);
+
+private:
+  struct SortItem
+  {
+    uint32_t key;
+    uint32_t index;
+  };
+
+  std::vector<DrawCommand> _commands;
+  std::vector<SortItem> _order;
+  std::vector<SortItem> _scratch;
+  std::vector<D3DXVECTOR3> _points;
+};
@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "frame_arena.hpp"
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+void *aligned_malloc(size_t bytes, size_t align)
+{
+#ifdef _WIN32
+  return _aligned_malloc(bytes, align);
+#else
+  void *p = nullptr;
+  if (posix_memalign(&p, align < sizeof(void *) ? sizeof(void *) : align, bytes) != 0)
+    return nullptr;
+  return p;
+#endif
+}
+
+void aligned_free(void *p)
+{
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+FrameArena::FrameArena(size_t capacity)
+  : _begin((char *)aligned_malloc(capacity, 64))
+{
+  _ptr = _begin;
+  _end = _begin ? _begin + capacity : _begin;
+}
+
+FrameArena::~FrameArena()
+{
+  reset();
+  aligned_free(_begin);
+}
+
+void *FrameArena::allocate(size_t bytes, size_t align)
+{
+  const uintptr_t p = ((uintptr_t)_ptr + align - 1) & ~(uintptr_t)(align - 1);
+  if (p + bytes <= (uintptr_t)_end) {
+    _ptr = (char *)(p + bytes);
+    return (void *)p;
+  }
+
+  void *mem = aligned_malloc(bytes, align);
+  if (mem)
+    _overflow.push_back(mem);
+  return mem;
+}
+
+void FrameArena::release(void *)
+{
+}
+
+void FrameArena::reset()
+{
+  for (size_t i = 0; i < _overflow.size(); ++i)
+    aligned_free(_overflow[i]);
+  _overflow.clear();
+  _ptr = _begin;
+}
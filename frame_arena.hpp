@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+// heap memory aligned to align bytes, a power of two
+void *aligned_malloc(size_t bytes, size_t align);
+void aligned_free(void *p);
+
+// where Matrix2d, and anything else that takes one, gets its memory
+struct Allocator
+{
+  virtual ~Allocator() {}
+  virtual void *allocate(size_t bytes, size_t align) = 0;
+  virtual void release(void *p) = 0;
+};
+
+// Bump allocator over a single block. release() does nothing, and reset()
+// frees everything at once, typically at the start of a frame, so per-frame
+// work doesn't touch the heap. Allocations that don't fit go to the heap
+// until the next reset, and are counted so the block can be sized.
+class FrameArena : public Allocator
+{
+public:
+  explicit FrameArena(size_t capacity);
+  ~FrameArena();
+
+  virtual void *allocate(size_t bytes, size_t align);
+  virtual void release(void *p);
+
+  void reset();
+
+  size_t used() const { return _ptr - _begin; }
+  size_t capacity() const { return _end - _begin; }
+  // heap allocations since the last reset
+  int overflows() const { return (int)_overflow.size(); }
+
+private:
+  FrameArena(const FrameArena&);
+  FrameArena& operator=(const FrameArena&);
+
+  char *_begin;
+  char *_ptr;
+  char *_end;
+  std::vector<void *> _overflow;
+};
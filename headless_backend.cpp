@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "headless_backend.hpp"
+#include "packed_vertex.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace
+{
+  struct MemorySink : public VertexSink
+  {
+    MemorySink(int stride, int capacity, bool is_static = false)
+      : _data(stride * capacity)
+      , _stride(stride)
+      , _capacity(capacity)
+      , _count(0)
+      , _static(is_static)
+    {
+    }
+
+    // draws copy what they use, so nothing is ever in use by a draw and
+    // both modes are the same
+    virtual void *map(MapMode)
+    {
+      assert(!_static);
+      return &_data[0];
+    }
+
+    void update(int first, const void *data, int count)
+    {
+      assert(_static && first >= 0 && first + count <= _capacity);
+      memcpy(&_data[first * _stride], data, count * _stride);
+    }
+
+    virtual int unmap(void *end)
+    {
+      _count = (int)((char *)end - &_data[0]) / _stride;
+      assert(_count >= 0 && _count <= _capacity);
+      return _count;
+    }
+
+    virtual int stride() const { return _stride; }
+    virtual int capacity() const { return _capacity; }
+
+    const void *data() const { return &_data[0]; }
+    // elements written by the last map/unmap, always 0 for a static sink
+    int count() const { return _count; }
+
+  private:
+    std::vector<char> _data;
+    int _stride;
+    int _capacity;
+    int _count;
+    bool _static;
+  };
+
+  // passes fence_latency frames after it's inserted, see HeadlessBackend
+  struct MockFence : public Fence
+  {
+    explicit MockFence(const HeadlessBackend *backend) : _backend(backend), _frame(-1) {}
+
+    virtual void insert()
+    {
+      _frame = _backend->frame();
+    }
+
+    virtual bool passed()
+    {
+      return _frame >= 0 && _backend->frame() - _frame >= _backend->fence_latency;
+    }
+
+  private:
+    const HeadlessBackend *_backend;
+    int _frame;
+  };
+}
+
+HeadlessBackend::HeadlessBackend(int width, int height)
+  : vertex_bytes(0)
+  , index_bytes(0)
+  , fence_latency(0)
+  , _extents((float)width, (float)height)
+  , _blend(kBlendDefault)
+  , _frame(0)
+{
+  constants.scale = D3DXVECTOR4(1, 1, 1, 1);
+  constants.bias = D3DXVECTOR4(0, 0, 0, 0);
+  constants.screen_to_clip = D3DXVECTOR4(1, 1, 0, 0);
+}
+
+bool HeadlessBackend::init()
+{
+  return true;
+}
+
+void HeadlessBackend::close()
+{
+  draws.clear();
+  vertices.clear();
+}
+
+D3DXVECTOR2 HeadlessBackend::extents() const
+{
+  return _extents;
+}
+
+VertexSink *HeadlessBackend::create_vertex_sink(int stride, int capacity)
+{
+  return new MemorySink(stride, capacity);
+}
+
+VertexSink *HeadlessBackend::create_index_sink(int stride, int capacity)
+{
+  assert(stride == 2 || stride == 4);
+  return new MemorySink(stride, capacity);
+}
+
+VertexSink *HeadlessBackend::create_instance_sink(int stride, int capacity)
+{
+  return new MemorySink(stride, capacity);
+}
+
+VertexSink *HeadlessBackend::create_static_vertex_sink(int stride, int capacity)
+{
+  return new MemorySink(stride, capacity, true);
+}
+
+VertexSink *HeadlessBackend::create_static_index_sink(int stride, int capacity)
+{
+  assert(stride == 2 || stride == 4);
+  return new MemorySink(stride, capacity, true);
+}
+
+void HeadlessBackend::update(VertexSink *sink, int first, const void *data, int count)
+{
+  static_cast<MemorySink *>(sink)->update(first, data, count);
+  // vertices are the only thing stored as PosCol or PackedVertex
+  if (sink->stride() == sizeof(PosCol) || sink->stride() == sizeof(PackedVertex))
+    vertex_bytes += count * sink->stride();
+  else
+    index_bytes += count * sink->stride();
+}
+
+Fence *HeadlessBackend::create_fence()
+{
+  return new MockFence(this);
+}
+
+void HeadlessBackend::start_frame(const FrameConstants& c)
+{
+  ++_frame;
+  constants = c;
+  draws.clear();
+  vertices.clear();
+  shapes.clear();
+  vertex_bytes = index_bytes = 0;
+  _blend = kBlendDefault;
+}
+
+void HeadlessBackend::set_constants(const FrameConstants& c)
+{
+  constants = c;
+}
+
+void HeadlessBackend::set_blend(BlendMode mode)
+{
+  _blend = mode;
+}
+
+const PosCol *HeadlessBackend::decode(VertexSink *sink, int first, int count)
+{
+  // packed vertices are decoded the way the input assembler and vsPacked
+  // would, into _unpacked, so the rest only sees PosCol
+  const MemorySink *mem = static_cast<MemorySink *>(sink);
+  if (sink->stride() == sizeof(PosCol))
+    return (const PosCol *)mem->data();
+  assert(sink->stride() == sizeof(PackedVertex));
+  const PackedVertex *src = (const PackedVertex *)mem->data();
+  _unpacked.resize(mem->count());
+  for (int i = first; i < first + count; ++i)
+    _unpacked[i] = unpack_vertex(src[i], constants.packed);
+  return _unpacked.data();
+}
+
+void HeadlessBackend::draw(VertexSink *sink, int first, int count)
+{
+  assert(first >= 0 && first + count <= sink->capacity());
+  const MemorySink *mem = static_cast<MemorySink *>(sink);
+  const PosCol *src = decode(sink, first, count) + first;
+  draws.push_back(DrawCall((int)vertices.size(), count, _blend));
+  vertices.insert(vertices.end(), src, src + count);
+  vertex_bytes += count * mem->stride();
+}
+
+void HeadlessBackend::draw_indexed(VertexSink *verts, VertexSink *indices, int first, int count, int base_vertex)
+{
+  assert(first >= 0 && first + count <= indices->capacity());
+  const MemorySink *vmem = static_cast<MemorySink *>(verts);
+  const MemorySink *imem = static_cast<MemorySink *>(indices);
+  const PosCol *src = decode(verts, 0, vmem->count()) + base_vertex;
+
+  draws.push_back(DrawCall((int)vertices.size(), count, _blend));
+  // a draw uses a contiguous range of vertices, so count the range its
+  // indices span rather than the whole sink, which other draws share
+  int lo = INT_MAX, hi = -1;
+  if (imem->stride() == 2) {
+    const uint16_t *idx = (const uint16_t *)imem->data() + first;
+    for (int i = 0; i < count; ++i) {
+      vertices.push_back(src[idx[i]]);
+      lo = std::min(lo, (int)idx[i]);
+      hi = std::max(hi, (int)idx[i]);
+    }
+  } else {
+    const uint32_t *idx = (const uint32_t *)imem->data() + first;
+    for (int i = 0; i < count; ++i) {
+      vertices.push_back(src[idx[i]]);
+      lo = std::min(lo, (int)idx[i]);
+      hi = std::max(hi, (int)idx[i]);
+    }
+  }
+  if (hi >= lo)
+    vertex_bytes += (hi - lo + 1) * vmem->stride();
+  index_bytes += count * imem->stride();
+}
+
+namespace
+{
+  // vsShape needs the pixel size as well
+  void expand(const FrameConstants&, const RectInstance& r, D3DXVECTOR2 *corners) { expand_instance(r, corners); }
+  void expand(const FrameConstants&, const LineInstance& l, D3DXVECTOR2 *corners) { expand_instance(l, corners); }
+  void expand(const FrameConstants& c, const ShapeInstance& s, D3DXVECTOR2 *corners)
+  {
+    expand_instance(s, D3DXVECTOR2(c.pixel_size.x, c.pixel_size.y), corners);
+  }
+
+  template<typename T>
+  void expand_instances(const FrameConstants& c, const T *instances, int count, std::vector<PosCol> *out)
+  {
+    // the shader goes straight to clip space, so map back through scale and
+    // bias to get vertices in the same space as the PosCol ones
+    const D3DXVECTOR4& s2c = c.screen_to_clip;
+    D3DXVECTOR2 corners[6];
+    for (int i = 0; i < count; ++i) {
+      const T& inst = instances[i];
+      expand(c, inst, corners);
+      const D3DXCOLOR col(inst.col);
+      for (int j = 0; j < 6; ++j) {
+        const float cx = corners[j].x * s2c.x + s2c.z;
+        const float cy = corners[j].y * s2c.y + s2c.w;
+        out->push_back(PosCol(D3DXVECTOR2((cx - c.bias.x) / c.scale.x, (cy - c.bias.y) / c.scale.y), inst.z, col));
+      }
+    }
+  }
+}
+
+void HeadlessBackend::draw_instanced(InstanceKind kind, VertexSink *instances, int first, int count)
+{
+  assert(first >= 0 && first + count <= instances->capacity());
+  const MemorySink *mem = static_cast<MemorySink *>(instances);
+  draws.push_back(DrawCall((int)vertices.size(), 6 * count, _blend, kind == kShapeInstance ? (int)shapes.size() : -1));
+  if (kind == kRectInstance) {
+    assert(mem->stride() == sizeof(RectInstance));
+    expand_instances(constants, (const RectInstance *)mem->data() + first, count, &vertices);
+  } else if (kind == kLineInstance) {
+    assert(mem->stride() == sizeof(LineInstance));
+    expand_instances(constants, (const LineInstance *)mem->data() + first, count, &vertices);
+  } else {
+    // the quads the shapes are found in, see SoftwareBackend for the rest
+    assert(mem->stride() == sizeof(ShapeInstance));
+    const ShapeInstance *src = (const ShapeInstance *)mem->data() + first;
+    expand_instances(constants, src, count, &vertices);
+    shapes.insert(shapes.end(), src, src + count);
+  }
+  vertex_bytes += count * mem->stride();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include "backend.hpp"
+
+// Backend that doesn't need a GPU. Vertex sinks are plain memory, and every
+// draw copies the submitted PosCol triangle list into the current frame, so the
+// CPU side of Thud can be driven and profiled on machines without D3D11.
+// PackedVertex sinks are decoded to PosCol first, and ShapeInstances are
+// drawn as the quads around them, which are kept in shapes.
+struct HeadlessBackend : public Backend
+{
+  struct DrawCall
+  {
+    DrawCall(int first, int count, BlendMode blend, int first_shape = -1)
+      : first(first), count(count), blend(blend), first_shape(first_shape) {}
+    // range in HeadlessBackend::vertices
+    int first;
+    int count;
+    BlendMode blend;
+    // for a draw of shapes, where its shapes start in HeadlessBackend::shapes,
+    // 6 vertices each, otherwise -1
+    int first_shape;
+  };
+
+  HeadlessBackend(int width, int height);
+
+  virtual bool init();
+  virtual void close();
+
+  virtual D3DXVECTOR2 extents() const;
+
+  virtual VertexSink *create_vertex_sink(int stride, int capacity);
+  virtual VertexSink *create_index_sink(int stride, int capacity);
+  virtual VertexSink *create_instance_sink(int stride, int capacity);
+  virtual VertexSink *create_static_vertex_sink(int stride, int capacity);
+  virtual VertexSink *create_static_index_sink(int stride, int capacity);
+  virtual void update(VertexSink *sink, int first, const void *data, int count);
+  // see fence_latency
+  virtual Fence *create_fence();
+
+  virtual void start_frame(const FrameConstants& constants);
+  virtual void set_constants(const FrameConstants& constants);
+  virtual void set_blend(BlendMode mode);
+  virtual void draw(VertexSink *sink, int first, int count);
+  // indexed and instanced draws are expanded, so vertices always holds a plain
+  // triangle list, in the same space as the PosCol vertices
+  virtual void draw_indexed(VertexSink *verts, VertexSink *indices, int first, int count, int base_vertex);
+  // instances are expanded on the cpu, with the same math as the vertex shader
+  virtual void draw_instanced(InstanceKind kind, VertexSink *instances, int first, int count);
+
+  int num_triangles() const { return (int)vertices.size() / 3; }
+  // start_frame calls so far
+  int frame() const { return _frame; }
+
+  // apply the current scale and bias, like the vertex shader does
+  D3DXVECTOR3 to_clip(const D3DXVECTOR3& pos) const
+  {
+    const D3DXVECTOR4& scale = constants.scale;
+    const D3DXVECTOR4& bias = constants.bias;
+    return D3DXVECTOR3(pos.x * scale.x + bias.x, pos.y * scale.y + bias.y, pos.z * scale.z + bias.z);
+  }
+
+  // state of the last frame. constants are the last ones set, so with
+  // several canvases, those of the top one
+  FrameConstants constants;
+  std::vector<DrawCall> draws;
+  std::vector<PosCol> vertices;
+  std::vector<ShapeInstance> shapes;
+  // bytes of the elements each draw used, and those written to the static
+  // sinks, ie what would be uploaded
+  int vertex_bytes;
+  int index_bytes;
+  // how many frames the pretend GPU is behind. A fence passes at the
+  // fence_latency'th start_frame after it's inserted, and straight away by
+  // default, as the draws are done by the time they return
+  int fence_latency;
+
+private:
+  // the vertices of sink as PosCol, valid from first to first + count
+  const PosCol *decode(VertexSink *sink, int first, int count);
+
+  D3DXVECTOR2 _extents;
+  BlendMode _blend;
+  int _frame;
+  std::vector<PosCol> _unpacked;
+};
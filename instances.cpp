@@ -0,0 +1,69 @@
+#include "stdafx.h"
+#include "instances.hpp"
+#include <algorithm>
+
+using namespace std;
+
+void expand_instance(const RectInstance& r, D3DXVECTOR2 *corners)
+{
+  // v0, v1, v2
+  // v2, v1, v3
+  static const float u[] = { 0, 1, 0, 0, 1, 1 };
+  static const float v[] = { 0, 0, 1, 1, 0, 1 };
+  for (int i = 0; i < 6; ++i)
+    corners[i] = D3DXVECTOR2(r.pos.x + u[i] * r.size.x, r.pos.y + v[i] * r.size.y);
+}
+
+void expand_instance(const LineInstance& l, D3DXVECTOR2 *corners)
+{
+  // v0 = p0 + n, v1 = p1 + n
+  // v2 = p0 - n, v3 = p1 - n
+  // v0, v2, v1
+  // v2, v3, v1
+  static const float along[] = { 0, 0, 1, 0, 1, 1 };
+  static const float side[] = { 1, -1, 1, -1, -1, 1 };
+
+  const D3DXVECTOR2 d = l.p1 - l.p0;
+  const float len = sqrtf(d.x * d.x + d.y * d.y);
+  const float s = len > 0 ? 0.5f * l.w / len : 0;
+  const D3DXVECTOR2 n(-d.y * s, d.x * s);
+  for (int i = 0; i < 6; ++i)
+    corners[i] = l.p0 + along[i] * d + side[i] * n;
+}
+
+void expand_instance(const ShapeInstance& s, const D3DXVECTOR2& pixel, D3DXVECTOR2 *corners)
+{
+  // the same triangles as a rect, around the centre
+  static const float u[] = { -1, 1, -1, -1, 1, 1 };
+  static const float v[] = { -1, -1, 1, 1, -1, 1 };
+  const D3DXVECTOR2 half(s.radii.x + pixel.x, s.radii.y + pixel.y);
+  for (int i = 0; i < 6; ++i)
+    corners[i] = D3DXVECTOR2(s.centre.x + u[i] * half.x, s.centre.y + v[i] * half.y);
+}
+
+float shape_distance(const D3DXVECTOR2& p, const D3DXVECTOR2& radii, float corner)
+{
+  if (corner < 0) {
+    // |p/r| - 1 scaled by the gradient, which is p - r for a circle
+    const float k1 = sqrtf(p.x * p.x / (radii.x * radii.x) + p.y * p.y / (radii.y * radii.y));
+    const float k2 = sqrtf(p.x * p.x / (radii.x * radii.x * radii.x * radii.x) +
+      p.y * p.y / (radii.y * radii.y * radii.y * radii.y));
+    return k2 > 0 ? k1 * (k1 - 1) / k2 : -min(radii.x, radii.y);
+  }
+  // distance to the rect shrunk by the corner radius, less the radius
+  const float qx = fabsf(p.x) - radii.x + corner;
+  const float qy = fabsf(p.y) - radii.y + corner;
+  const float ox = max(qx, 0.0f);
+  const float oy = max(qy, 0.0f);
+  return sqrtf(ox * ox + oy * oy) + min(max(qx, qy), 0.0f) - corner;
+}
+
+float shape_coverage(float distance, bool blended)
+{
+  // written so a NaN from a shape with no size covers nothing, as saturate
+  // does in the shader
+  if (!blended)
+    return distance <= 0 ? 1.0f : 0.0f;
+  const float c = 0.5f - distance;
+  return c > 0 ? min(c, 1.0f) : 0.0f;
+}
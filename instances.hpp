@@ -0,0 +1,69 @@
+#pragma once
+
+#include "thud_types.hpp"
+
+// Per-instance records for the instanced primitives. The cpu writes one of
+// these per shape, in screen space, and the vertex shader expands it into the
+// same 6 vertices Thud::rect and Thud::line would have written, or for a
+// ShapeInstance, into the quad the pixel shader finds the outline in.
+// Colours are packed 0xAARRGGBB.
+
+enum InstanceKind
+{
+  kRectInstance,
+  kLineInstance,
+  kShapeInstance,
+  kNumInstanceKinds,
+};
+
+struct RectInstance
+{
+  D3DXVECTOR2 pos;
+  D3DXVECTOR2 size;
+  float z;
+  UINT32 col;
+};
+
+struct LineInstance
+{
+  D3DXVECTOR2 p0;
+  D3DXVECTOR2 p1;
+  float w;
+  // both ends share the depth of p0
+  float z;
+  UINT32 col;
+};
+
+// A circle, ellipse or rounded rect. Rather than tessellating the outline,
+// psShape works out each pixel's signed distance to it, so the edge is exact
+// at any size and zoom, and the cost on the cpu is the same for all of them
+struct ShapeInstance
+{
+  D3DXVECTOR2 centre;
+  // half the width and height
+  D3DXVECTOR2 radii;
+  // corner radius of a rounded rect, at most the smaller of the radii, or
+  // negative for an ellipse
+  float corner;
+  float z;
+  UINT32 col;
+};
+
+// Cpu reference for the expansion done by vsRect and vsLine. Writes the
+// screen space corners of the two triangles.
+void expand_instance(const RectInstance& r, D3DXVECTOR2 *corners);
+void expand_instance(const LineInstance& l, D3DXVECTOR2 *corners);
+// and by vsShape, whose quad is a pixel bigger than the shape on each side so
+// the antialiased edge isn't cut off. pixel is the size of a pixel in screen
+// units, see FrameConstants::pixel_size
+void expand_instance(const ShapeInstance& s, const D3DXVECTOR2& pixel, D3DXVECTOR2 *corners);
+
+// Cpu reference for psShape. The signed distance in pixels from p to the
+// outline, negative inside, with everything relative to the centre and in
+// pixels. Exact for circles and rounded rects, and for ellipses close enough
+// near the outline for coverage
+float shape_distance(const D3DXVECTOR2& p, const D3DXVECTOR2& radii, float corner);
+// How much of a pixel the shape covers at that distance. A pixel wide ramp
+// when blended, and all or nothing when not, as an opaque draw ignores alpha
+// and a partly covered pixel would come out as dark as a covered one
+float shape_coverage(float distance, bool blended);
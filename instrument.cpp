@@ -0,0 +1,124 @@
+#include "stdafx.h"
+#include "instrument.hpp"
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+namespace
+{
+  uint32_t thread_number()
+  {
+    return (uint32_t)hash<thread::id>()(this_thread::get_id());
+  }
+
+  // events are in the order they ended, so the first to start may be later
+  int64_t first_start(const vector<TraceEvent>& ev)
+  {
+    int64_t t = ev.empty() ? 0 : ev[0].start_ns;
+    for (size_t i = 1; i < ev.size(); ++i)
+      t = min(t, ev[i].start_ns);
+    return t;
+  }
+}
+
+void FrameStats::reset()
+{
+  memset(primitives, 0, sizeof(primitives));
+  recorded = 0;
+  vertices = instances = 0;
+  bytes_mapped = bytes_uploaded = 0;
+  draw_calls = 0;
+  start_frame_ns = tessellate_ns = render_ns = 0;
+}
+
+TraceRing::TraceRing(int capacity)
+  : _mask(1)
+  , _next(0)
+{
+  while (_mask < (uint64_t)capacity)
+    _mask *= 2;
+  _slots = vector<Slot>(_mask);
+  _mask -= 1;
+  clear();
+}
+
+void TraceRing::add(const char *name, int64_t start_ns, int64_t duration_ns)
+{
+  const uint64_t seq = _next.fetch_add(1, memory_order_relaxed);
+  Slot& slot = _slots[seq & _mask];
+  // 0 marks the slot as being written, until the new stamp goes in
+  slot.seq.store(0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot.event.name = name;
+  slot.event.start_ns = start_ns;
+  slot.event.duration_ns = duration_ns;
+  slot.event.thread = thread_number();
+  slot.seq.store(seq + 1, memory_order_release);
+}
+
+void TraceRing::clear()
+{
+  for (size_t i = 0; i < _slots.size(); ++i)
+    _slots[i].seq.store(0, memory_order_relaxed);
+  _next.store(0, memory_order_release);
+}
+
+void TraceRing::events(vector<TraceEvent> *out) const
+{
+  out->clear();
+  const uint64_t end = _next.load(memory_order_acquire);
+  const uint64_t begin = end > _slots.size() ? end - _slots.size() : 0;
+  for (uint64_t seq = begin; seq < end; ++seq) {
+    const Slot& slot = _slots[seq & _mask];
+    if (slot.seq.load(memory_order_acquire) != seq + 1)
+      continue;
+    const TraceEvent event = slot.event;
+    // overwritten while it was copied
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.seq.load(memory_order_relaxed) != seq + 1)
+      continue;
+    out->push_back(event);
+  }
+}
+
+bool TraceRing::write_csv(const char *path) const
+{
+  vector<TraceEvent> ev;
+  events(&ev);
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+  const int64_t origin = first_start(ev);
+  fprintf(f, "name,thread,start_us,duration_us\n");
+  for (size_t i = 0; i < ev.size(); ++i)
+    fprintf(f, "%s,%u,%.3f,%.3f\n", ev[i].name, ev[i].thread,
+      (ev[i].start_ns - origin) / 1e3, ev[i].duration_ns / 1e3);
+  return fclose(f) == 0;
+}
+
+bool TraceRing::write_chrome_json(const char *path) const
+{
+  vector<TraceEvent> ev;
+  events(&ev);
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+  const int64_t origin = first_start(ev);
+  fprintf(f, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < ev.size(); ++i)
+    fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+      ev[i].name, ev[i].thread, (ev[i].start_ns - origin) / 1e3, ev[i].duration_ns / 1e3,
+      i + 1 < ev.size() ? "," : "");
+  fprintf(f, "]}\n");
+  return fclose(f) == 0;
+}
+
+TraceRing& trace_ring()
+{
+  static TraceRing ring(64 * 1024);
+  return ring;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <stdint.h>
+
+// Instrumentation, compiled in when THUD_STATS is defined to 1. Without it
+// the macros expand to nothing, so FrameStats stays zero, nothing is traced,
+// and the hot paths carry no extra code.
+#ifndef THUD_STATS
+#define THUD_STATS 0
+#endif
+
+// monotonic nanoseconds, from an arbitrary start
+inline int64_t trace_now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What the last frame cost, from start_frame to render. Thud keeps one and
+// its arenas add to it, see Thud::stats
+struct FrameStats
+{
+  FrameStats() { reset(); }
+  void reset();
+
+  // submitted after culling, by CommandKind, and merged from recorders
+  enum { kNumKinds = 6 };
+  int primitives[kNumKinds];
+  int recorded;
+  // triangle vertices and instances written to the arenas
+  int64_t vertices;
+  int64_t instances;
+  // the whole chunks mapped, and what was written to them or to the static
+  // sinks of retained groups, ie what goes over the bus
+  int64_t bytes_mapped;
+  int64_t bytes_uploaded;
+  int draw_calls;
+  // tessellation happens in render for a deferred frame, so render_ns
+  // includes it there. Otherwise it's timed around each primitive, which
+  // costs two clock reads apiece, so small primitives get a lot slower
+  int64_t start_frame_ns;
+  int64_t tessellate_ns;
+  int64_t render_ns;
+};
+
+// adds the time until the end of the scope to *ns
+class ScopedTimer
+{
+public:
+  explicit ScopedTimer(int64_t *ns) : _ns(ns), _start(trace_now_ns()) {}
+  ~ScopedTimer() { *_ns += trace_now_ns() - _start; }
+private:
+  int64_t *_ns;
+  int64_t _start;
+};
+
+struct TraceEvent
+{
+  // a string literal, or anything else that outlives the ring
+  const char *name;
+  int64_t start_ns;
+  int64_t duration_ns;
+  uint32_t thread;
+};
+
+// Fixed size ring of the most recent events. Any number of threads can add
+// events without locking: each takes the next slot with an atomic increment,
+// and the oldest events are overwritten. A slot is stamped with its sequence
+// number once written, so a dump taken while events are coming in skips the
+// slots still being written, but dump between frames to get every event.
+class TraceRing
+{
+public:
+  // capacity is rounded up to a power of two
+  explicit TraceRing(int capacity);
+
+  void add(const char *name, int64_t start_ns, int64_t duration_ns);
+  void clear();
+
+  // the events still in the ring, oldest first
+  void events(std::vector<TraceEvent> *out) const;
+  // name,thread,start_us,duration_us rows, with times from the first event
+  bool write_csv(const char *path) const;
+  // chrome://tracing and Perfetto format, complete events in microseconds
+  bool write_chrome_json(const char *path) const;
+
+private:
+  TraceRing(const TraceRing&);
+  TraceRing& operator=(const TraceRing&);
+
+  struct Slot
+  {
+    std::atomic<uint64_t> seq;
+    TraceEvent event;
+  };
+
+  std::vector<Slot> _slots;
+  uint64_t _mask;
+  std::atomic<uint64_t> _next;
+};
+
+// the ring THUD_TRACE adds to, 64K events
+TraceRing& trace_ring();
+
+// adds an event covering the rest of the scope to trace_ring
+class TraceScope
+{
+public:
+  explicit TraceScope(const char *name) : _name(name), _start(trace_now_ns()) {}
+  ~TraceScope() { trace_ring().add(_name, _start, trace_now_ns() - _start); }
+private:
+  const char *_name;
+  int64_t _start;
+};
+
+#define THUD_CONCAT_(a, b) a##b
+#define THUD_CONCAT(a, b) THUD_CONCAT_(a, b)
+
+#if THUD_STATS
+// stats is a FrameStats pointer, and may be null
+#define THUD_COUNT(stats, field, n) do { if (stats) (stats)->field += (n); } while (0)
+#define THUD_TIME(ns) ScopedTimer THUD_CONCAT(_thud_timer_, __LINE__)(&(ns))
+#define THUD_TRACE(name) TraceScope THUD_CONCAT(_thud_trace_, __LINE__)(name)
+#else
+#define THUD_COUNT(stats, field, n) do {} while (0)
+#define THUD_TIME(ns) do {} while (0)
+#define THUD_TRACE(name) do {} while (0)
+#endif
@@ -0,0 +1,149 @@
+#include "stdafx.h"
+#include <windows.h>
+#include <vector>
+#include <celsus/graphics.hpp>
+#include <celsus/error2.hpp>
+#include <celsus/Logger.hpp>
+#include <celsus/math_utils.hpp>
+#include <D3DX10math.h>
+#define ANT_TW_SUPPORT_DX11
+#include <libs/AntTweakBar/include/AntTweakBar.h>
+#include "thud.hpp"
+#include "bezier.hpp"
+#include "d3d11_backend.hpp"
+
+using namespace std;
+
+LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+  if( TwEventWin(hWnd, message, wParam, lParam) ) // send event message to AntTweakBar
+    return 0;
+
+  switch(message)
+  {
+
+  case WM_KEYUP:
+    switch (wParam)
+    {
+    case VK_ESCAPE:
+      PostQuitMessage(0);
+      break;
+    }
+    break;
+  case WM_DESTROY:
+    PostQuitMessage(0);
+    break;
+  default:
+    return DefWindowProc(hWnd, message, wParam, lParam);
+  }
+
+  return 0;
+}
+
+D3DXVECTOR3 bezier(float t, const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, const D3DXVECTOR3& p2, const D3DXVECTOR3& p3)
+{
+	const float tt = (1-t);
+	const float tt2 = tt*tt;
+	const float tt3 = tt2*tt;
+
+	const float t2 = t*t;
+	const float t3 = t2*t;
+
+	return tt3 * p0 + 3 * tt2 * t * p1 + 3 * tt * t2 * p2 + t3 * p3;
+}
+
+int WINAPI WinMain( __in HINSTANCE hInstance, __in_opt HINSTANCE hPrevInstance, __in LPSTR lpCmdLine, __in int nShowCmd )
+{
+
+  static TCHAR window_class[] = _T("Thud Main Window");
+  const int width = GetSystemMetrics(SM_CXSCREEN) / 2;
+  const int height = GetSystemMetrics(SM_CYSCREEN) / 2;
+	const float apsect = (float)width / height;
+
+  WNDCLASSEX wcex;
+  ZeroMemory(&wcex, sizeof(wcex));
+  wcex.cbSize = sizeof(wcex);
+  wcex.style = CS_HREDRAW | CS_VREDRAW;
+  wcex.lpfnWndProc = WndProc;
+  wcex.hInstance = hInstance;
+  wcex.lpszClassName = window_class;
+
+  if (!RegisterClassEx(&wcex))
+    return 1;
+
+  const DWORD style = WS_OVERLAPPEDWINDOW;
+  RECT r;
+  r.top = 0;
+  r.left = 0;
+  r.bottom = height;
+  r.right = width;
+  AdjustWindowRect(&r, style, TRUE);
+  int w = r.right - r.left;
+  int h = r.bottom - r.top;
+
+  HWND hwnd = CreateWindow(window_class, window_class, style, CW_USEDEFAULT, CW_USEDEFAULT, w, h, NULL, NULL, hInstance, NULL);
+  if (!hwnd)
+    return 1;
+
+  ShowWindow(hwnd, nShowCmd);
+  UpdateWindow(hwnd);
+
+  Graphics& graphics = Graphics::instance();
+  Thud& thud = Thud::instance();
+
+
+  if (!graphics.init_directx(hwnd, width, height))
+    return 1;
+
+  if (!thud.init(new D3D11Backend()))
+    return 1;
+
+  MSG msg;
+  ZeroMemory(&msg, sizeof(msg));
+
+  D3DXVECTOR3 pts[] = 
+  {
+    D3DXVECTOR3(0, 0, 0),
+    D3DXVECTOR3(160, 100, 0),
+    D3DXVECTOR3(500, 200, 0),
+    D3DXVECTOR3(200, 500, 0),
+    D3DXVECTOR3((float)width, (float)height, 0),
+  };
+
+  const int num = ELEMS_IN_ARRAY(pts);
+
+  Bezier bb = Bezier::from_points(AsArray<D3DXVECTOR3>(pts, num));
+
+  TwInit(TW_DIRECT3D11, graphics.device(), graphics.context());
+  TwWindowSize(width, height);
+
+  TwBar *myBar = TwNewBar("NameOfMyTweakBar");
+  int apa = 10;
+  TwAddVarRW(myBar, "NameOfMyVariable", TW_TYPE_INT32, &apa, "");
+
+  while (WM_QUIT != msg.message) {
+    if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+    } else {
+      graphics.clear(D3DXCOLOR(0.5f, 0.5f, 0.5f, 1));
+      //thud.start_frame();
+      //thud.clear(D3DXCOLOR(0, 1, 0, 1));
+      //thud.set_fill(D3DXCOLOR(1,1,1,1));
+			//thud.circle(D3DXVECTOR3(width/2.0f, height/2.0f,0.5f), width/4.0f);
+			//thud.rect(D3DXVECTOR3(0,0,0), D3DXVECTOR3(width/2.0f, height/2.0f, 0));
+			//thud.rect(D3DXVECTOR3(width/2,height/2,0), D3DXVECTOR3(width/2.0f, height/2.0f, 0));
+
+			//thud.bezier(bb, 1);
+      //thud.render();
+      TwDraw();
+      graphics.present();
+    }
+  }
+
+  TwTerminate();
+  thud.close();
+  graphics.close();
+
+  return (int)msg.wParam;
+}
@@ -0,0 +1,62 @@
+#include "stdafx.h"
+#include "matrix2d.hpp"
+
+#if defined(__AVX2__) || defined(__AVX__)
+#define THUD_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THUD_SSE2
+#include <emmintrin.h>
+#endif
+
+void sub_scaled(float *y, const float *x, float a, int n)
+{
+  int i = 0;
+#if defined(THUD_AVX)
+  const __m256 va = _mm256_set1_ps(a);
+  for (; i + 8 <= n; i += 8) {
+    const __m256 vx = _mm256_loadu_ps(x + i);
+    const __m256 vy = _mm256_loadu_ps(y + i);
+#if defined(__FMA__)
+    _mm256_storeu_ps(y + i, _mm256_fnmadd_ps(va, vx, vy));
+#else
+    _mm256_storeu_ps(y + i, _mm256_sub_ps(vy, _mm256_mul_ps(va, vx)));
+#endif
+  }
+#elif defined(THUD_SSE2)
+  const __m128 va = _mm_set1_ps(a);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 vx = _mm_loadu_ps(x + i);
+    const __m128 vy = _mm_loadu_ps(y + i);
+    _mm_storeu_ps(y + i, _mm_sub_ps(vy, _mm_mul_ps(va, vx)));
+  }
+#endif
+  for (; i < n; ++i)
+    y[i] -= a * x[i];
+}
+
+void sub_scaled(double *y, const double *x, double a, int n)
+{
+  int i = 0;
+#if defined(THUD_AVX)
+  const __m256d va = _mm256_set1_pd(a);
+  for (; i + 4 <= n; i += 4) {
+    const __m256d vx = _mm256_loadu_pd(x + i);
+    const __m256d vy = _mm256_loadu_pd(y + i);
+#if defined(__FMA__)
+    _mm256_storeu_pd(y + i, _mm256_fnmadd_pd(va, vx, vy));
+#else
+    _mm256_storeu_pd(y + i, _mm256_sub_pd(vy, _mm256_mul_pd(va, vx)));
+#endif
+  }
+#elif defined(THUD_SSE2)
+  const __m128d va = _mm_set1_pd(a);
+  for (; i + 2 <= n; i += 2) {
+    const __m128d vx = _mm_loadu_pd(x + i);
+    const __m128d vy = _mm_loadu_pd(y + i);
+    _mm_storeu_pd(y + i, _mm_sub_pd(vy, _mm_mul_pd(va, vx)));
+  }
+#endif
+  for (; i < n; ++i)
+    y[i] -= a * x[i];
+}
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "console.hpp"
+#include "frame_arena.hpp"
+
+#ifndef MATRIX2D_INLINE_BYTES
+// matrices up to this many bytes are stored inside the Matrix2d itself, and
+// never allocate. 0 turns the inline buffer off
+#define MATRIX2D_INLINE_BYTES 128
+#endif
+
+// Dense row-major matrix. Storage is 64 byte aligned when it comes from the
+// heap or an allocator. Inline storage is only 32 byte aligned when the
+// matrix is on the stack or static, as before C++17 new and std::vector
+// ignore over-alignment, so heap allocated matrices get the allocator's
+// usual 8 or 16. An Allocator, like a FrameArena, can be passed in to keep
+// per-frame matrices off the heap. A copy constructed matrix uses the
+// allocator of the one it copies, copy assignment keeps the destination's,
+// and moves take the storage along with the allocator it came from.
+template<typename T>
+struct Matrix2d
+{
+  enum { kAlign = 64, kInlineElems = MATRIX2D_INLINE_BYTES / sizeof(T) };
+
+  explicit Matrix2d(Allocator *allocator = nullptr)
+    : _data(nullptr)
+    , _rows(0)
+    , _cols(0)
+    , _capacity(0)
+    , _allocator(allocator)
+  {
+    use_inline();
+  }
+
+  Matrix2d(int rows, int cols, Allocator *allocator = nullptr)
+    : _data(nullptr)
+    , _rows(0)
+    , _cols(0)
+    , _capacity(0)
+    , _allocator(allocator)
+  {
+    use_inline();
+    init(rows, cols);
+  }
+
+  // the contents are undefined afterwards. The storage is reused when it's
+  // big enough, so re-initing a matrix to the same or a smaller size is free
+  void init(int rows, int cols)
+  {
+    const int n = rows * cols;
+    if (n > _capacity) {
+      free_storage();
+      if (n <= kInlineElems) {
+        use_inline();
+      } else {
+        const size_t bytes = n * sizeof(T);
+        _data = (T *)(_allocator ? _allocator->allocate(bytes, kAlign) : aligned_malloc(bytes, kAlign));
+        _capacity = n;
+      }
+    }
+    _rows = rows;
+    _cols = cols;
+  }
+
+  ~Matrix2d()
+  {
+    free_storage();
+  }
+
+  Matrix2d(const Matrix2d& rhs)
+    : _data(nullptr)
+    , _rows(0)
+    , _cols(0)
+    , _capacity(0)
+    , _allocator(rhs._allocator)
+  {
+    use_inline();
+    assign(rhs);
+  }
+
+  Matrix2d(Matrix2d&& rhs)
+    : _data(nullptr)
+    , _rows(0)
+    , _cols(0)
+    , _capacity(0)
+    , _allocator(rhs._allocator)
+  {
+    use_inline();
+    take(rhs);
+  }
+
+  Matrix2d& operator=(const Matrix2d& rhs)
+  {
+    if (&rhs != this)
+      assign(rhs);
+    return *this;
+  }
+
+  Matrix2d& operator=(Matrix2d&& rhs)
+  {
+    if (&rhs != this) {
+      free_storage();
+      use_inline();
+      _allocator = rhs._allocator;
+      take(rhs);
+    }
+    return *this;
+  }
+
+  const T& at(int row, int col) const
+  {
+    return _data[row*_cols+col];
+  }
+
+  T& at(int row, int col)
+  {
+    return _data[row*_cols+col];
+  }
+
+  const T& operator()(int row, int col) const
+  {
+    return _data[row*_cols+col];
+  }
+
+  T& operator()(int row, int col)
+  {
+    return _data[row*_cols+col];
+  }
+
+  // frees the storage
+  void reset()
+  {
+    free_storage();
+    use_inline();
+    _rows = _cols = 0;
+  }
+
+  void assign(const Matrix2d& rhs)
+  {
+    init(rhs._rows, rhs._cols);
+    if (_rows > 0 && _cols > 0)
+      memcpy(_data, rhs._data, _rows * _cols * sizeof(T));
+  }
+
+  int rows() const { return _rows; }
+  int cols() const { return _cols; }
+  Allocator *allocator() const { return _allocator; }
+  bool is_inline() const
+  {
+#if MATRIX2D_INLINE_BYTES > 0
+    return _data == (T *)_inline;
+#else
+    return false;
+#endif
+  }
+
+  void augment(const Matrix2d& a, Matrix2d *out)
+  {
+    // out = [this|a];
+    out->init(rows(), cols() + a.cols());
+
+    const int nr = out->rows();
+    const int nc = out->cols();
+
+    for (int i = 0; i < out->rows(); ++i) {
+      memcpy(&out->_data[i*nc], &_data[i*cols()], cols()*sizeof(T));
+      memcpy(&out->_data[i*nc+cols()], &a._data[i*a.cols()], a.cols()*sizeof(T));
+    }
+  }
+
+  void console_print()
+  {
+    for (int i = 0; i < rows(); ++i) {
+      for (int j = 0; j < cols(); ++j) {
+        console_printf("%8f ", at(i,j));
+      }
+      console_printf("\n");
+    }
+    console_printf("\n");
+  }
+
+  void print()
+  {
+    for (int i = 0; i < rows(); ++i) {
+      for (int j = 0; j < cols(); ++j) {
+        printf("%8f ", at(i,j));
+      }
+      printf("\n");
+    }
+    printf("\n");
+  }
+
+  void use_inline()
+  {
+#if MATRIX2D_INLINE_BYTES > 0
+    _data = (T *)_inline;
+    _capacity = kInlineElems;
+#else
+    _data = nullptr;
+    _capacity = 0;
+#endif
+  }
+
+  void free_storage()
+  {
+    if (_data && !is_inline()) {
+      if (_allocator)
+        _allocator->release(_data);
+      else
+        aligned_free(_data);
+    }
+    _data = nullptr;
+    _capacity = 0;
+  }
+
+  // move rhs into this, which has no storage of its own
+  void take(Matrix2d& rhs)
+  {
+    if (rhs.is_inline()) {
+      assign(rhs);
+    } else {
+      _data = rhs._data;
+      _capacity = rhs._capacity;
+      _rows = rhs._rows;
+      _cols = rhs._cols;
+      rhs.use_inline();
+    }
+    rhs._rows = rhs._cols = 0;
+  }
+
+  T* _data;
+  int _rows;
+  int _cols;
+  int _capacity;
+  Allocator *_allocator;
+#if MATRIX2D_INLINE_BYTES > 0
+  alignas(32) char _inline[MATRIX2D_INLINE_BYTES];
+#endif
+};
+
+
+template<typename T>
+void augment(const Matrix2d<T>& a, const Matrix2d<T>& b, Matrix2d<T> *out)
+{
+  // out = [a|b];
+  out->init(a.rows(), a.cols() + b.cols());
+
+  const int nr = out->rows();
+  const int nc = out->cols();
+
+  for (int i = 0; i < out->rows(); ++i) {
+    memcpy(&out->_data[i*nc], &a._data[i*a.cols()], a.cols()*sizeof(T));
+    memcpy(&out->_data[i*nc+a.cols()], &b._data[i*b.cols()], b.cols()*sizeof(T));
+  }
+}
+
+// y[i] -= a * x[i], the inner loop of the factorization and the solves.
+// float and double have simd versions in matrix2d.cpp
+template<typename T>
+void sub_scaled(T *y, const T *x, T a, int n)
+{
+  for (int i = 0; i < n; ++i)
+    y[i] -= a * x[i];
+}
+
+void sub_scaled(float *y, const float *x, float a, int n);
+void sub_scaled(double *y, const double *x, double a, int n);
+
+// LU factorization with partial pivoting, P*a = L*U. L (with a unit
+// diagonal) and U overwrite a, and row i of P*a is row perm[i] of a, where
+// perm holds a.rows() ints. Returns false if a is singular.
+//
+// The factorization is blocked: a panel of kLuBlock columns is factored, and
+// the trailing matrix is updated a tile of columns at a time, so the rows of
+// U being subtracted stay in cache. O(n^3), but mostly in sub_scaled
+template<typename T>
+bool lu_factor(Matrix2d<T>& a, int *perm)
+{
+  assert(a.rows() == a.cols());
+  const int kLuBlock = 32;
+  const int kLuTile = 256;
+  const int n = a.rows();
+
+  for (int i = 0; i < n; ++i)
+    perm[i] = i;
+
+  for (int k0 = 0; k0 < n; k0 += kLuBlock) {
+    const int k1 = std::min(n, k0 + kLuBlock);
+
+    // factor the panel, columns [k0, k1)
+    for (int k = k0; k < k1; ++k) {
+      int pivot = k;
+      T best = (T)fabs(a(k, k));
+      for (int i = k + 1; i < n; ++i) {
+        const T v = (T)fabs(a(i, k));
+        if (v > best) {
+          best = v;
+          pivot = i;
+        }
+      }
+      // also catches nans
+      if (!(best > 0))
+        return false;
+
+      if (pivot != k) {
+        std::swap_ranges(&a(k, 0), &a(k, 0) + n, &a(pivot, 0));
+        std::swap(perm[k], perm[pivot]);
+      }
+
+      const T inv = 1 / a(k, k);
+      for (int i = k + 1; i < n; ++i) {
+        T& l = a(i, k);
+        l *= inv;
+        if (l != 0)
+          sub_scaled(&a(i, k + 1), &a(k, k + 1), l, k1 - k - 1);
+      }
+    }
+
+    if (k1 == n)
+      break;
+
+    // U12 = L11^-1 * A12
+    for (int k = k0; k < k1; ++k) {
+      for (int i = k + 1; i < k1; ++i) {
+        if (a(i, k) != 0)
+          sub_scaled(&a(i, k1), &a(k, k1), a(i, k), n - k1);
+      }
+    }
+
+    // A22 -= L21 * U12
+    for (int j0 = k1; j0 < n; j0 += kLuTile) {
+      const int cols = std::min(n - j0, kLuTile);
+      for (int i = k1; i < n; ++i) {
+        for (int k = k0; k < k1; ++k) {
+          if (a(i, k) != 0)
+            sub_scaled(&a(i, j0), &a(k, j0), a(i, k), cols);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// solve a*x = b for every column of b, where lu and perm come from
+// lu_factor(a). b is overwritten with x, so x, y and z can be solved
+// together as a 3 column b. Scratch memory comes from b's allocator
+template<typename T>
+void lu_solve(const Matrix2d<T>& lu, const int *perm, Matrix2d<T> *b)
+{
+  const int n = lu.rows();
+  const int m = b->cols();
+  assert(b->rows() == n);
+
+  // x = P*b
+  Matrix2d<T> scratch(n, m, b->allocator());
+  T *x = scratch._data;
+  for (int i = 0; i < n; ++i)
+    memcpy(&x[i * m], &b->at(perm[i], 0), m * sizeof(T));
+
+  // L*y = P*b
+  for (int i = 1; i < n; ++i) {
+    for (int k = 0; k < i; ++k) {
+      if (lu(i, k) != 0)
+        sub_scaled(&x[i * m], &x[k * m], lu(i, k), m);
+    }
+  }
+
+  // U*x = y
+  for (int i = n - 1; i >= 0; --i) {
+    for (int k = i + 1; k < n; ++k) {
+      if (lu(i, k) != 0)
+        sub_scaled(&x[i * m], &x[k * m], lu(i, k), m);
+    }
+    const T inv = 1 / lu(i, i);
+    for (int j = 0; j < m; ++j)
+      x[i * m + j] *= inv;
+  }
+
+  memcpy(b->_data, x, n * m * sizeof(T));
+}
+
+// solve m*x = a via lu_factor, for every column of a. Returns false if m is
+// singular. The temporaries come from x's allocator
+template<typename T>
+bool lu_solve(const Matrix2d<T>& m, const Matrix2d<T>& a, Matrix2d<T> *x)
+{
+  assert(m.rows() == m.cols() && m.rows() == a.rows());
+  Matrix2d<T> lu(x->allocator());
+  lu.assign(m);
+  Matrix2d<int> perm(m.rows(), 1, x->allocator());
+  if (!lu_factor(lu, perm._data))
+    return false;
+
+  x->assign(a);
+  lu_solve(lu, perm._data, x);
+  return true;
+}
+
+template<typename T>
+bool gaussian_solve(Matrix2d<T>& c, Matrix2d<T> *x)
+{
+  // solve m*x = a, where c is the augmented matrix [m|a]. a can have more
+  // than one column
+  const int n = c.rows();
+  assert(c.cols() > n);
+  Matrix2d<T> m(n, n, x->allocator());
+  Matrix2d<T> a(n, c.cols() - n, x->allocator());
+  for (int i = 0; i < n; ++i) {
+    memcpy(&m.at(i, 0), &c.at(i, 0), n * sizeof(T));
+    memcpy(&a.at(i, 0), &c.at(i, n), a.cols() * sizeof(T));
+  }
+  return lu_solve(m, a, x);
+}
+
+template<typename T>
+bool gaussian_solve(const Matrix2d<T>& m, const Matrix2d<T>& a, Matrix2d<T> *x)
+{
+  // solve m*x = a
+  return lu_solve(m, a, x);
+}
@@ -0,0 +1,93 @@
+#include "stdafx.h"
+#include "packed_vertex.hpp"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THUD_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  inline float clamp(float v, float lo, float hi)
+  {
+    return v < lo ? lo : v > hi ? hi : v;
+  }
+
+  // rounded to nearest, with halves away from 0
+  inline int16_t to_snorm16(float v)
+  {
+    const float s = clamp(v, -1, 1) * 32767;
+    return (int16_t)(s < 0 ? s - 0.5f : s + 0.5f);
+  }
+
+  inline uint16_t to_unorm16(float v)
+  {
+    return (uint16_t)(clamp(v, 0, 1) * 65535 + 0.5f);
+  }
+
+  inline uint8_t to_unorm8(float v)
+  {
+    return (uint8_t)(clamp(v, 0, 1) * 255 + 0.5f);
+  }
+}
+
+void pack_vertices(const PosCol *src, PackedVertex *dst, int n, const D3DXVECTOR4& packed)
+{
+  const float sx = 1 / packed.x, sy = 1 / packed.y;
+  const float bx = packed.z, by = packed.w;
+  int i = 0;
+#if defined(THUD_SSE2)
+  // a vertex at a time, as x y z r and r g b a, in the same order of
+  // operations as below so the results are the same
+  const __m128 pos_bias = _mm_setr_ps(bx, by, 0, 0);
+  const __m128 pos_scale = _mm_setr_ps(sx, sy, 1, 0);
+  const __m128 pos_lo = _mm_setr_ps(-1, -1, 0, 0);
+  const __m128 one = _mm_set1_ps(1);
+  const __m128 pos_range = _mm_setr_ps(32767, 32767, 65535, 0);
+  const __m128 col_range = _mm_set1_ps(255);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 zero = _mm_setzero_ps();
+  for (; i < n; ++i) {
+    const float *v = &src[i].pos.x;
+    __m128 p = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v), pos_bias), pos_scale);
+    p = _mm_mul_ps(_mm_min_ps(_mm_max_ps(p, pos_lo), one), pos_range);
+    p = _mm_add_ps(p, _mm_or_ps(half, _mm_and_ps(p, sign)));
+    __m128 c = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(v + 3), zero), one), col_range);
+    c = _mm_add_ps(c, half);
+
+    const __m128i ip = _mm_cvttps_epi32(p);
+    const __m128i ic = _mm_cvttps_epi32(c);
+    PackedVertex& d = dst[i];
+    d.x = (int16_t)_mm_cvtsi128_si32(ip);
+    d.y = (int16_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(ip, _MM_SHUFFLE(1, 1, 1, 1)));
+    d.z = (uint16_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(ip, _MM_SHUFFLE(2, 2, 2, 2)));
+    d.pad = 0;
+    const int rgba = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(ic, ic), ic));
+    memcpy(d.col, &rgba, 4);
+  }
+#endif
+  for (; i < n; ++i) {
+    const PosCol& v = src[i];
+    PackedVertex& p = dst[i];
+    p.x = to_snorm16((v.pos.x - bx) * sx);
+    p.y = to_snorm16((v.pos.y - by) * sy);
+    p.col[0] = to_unorm8(v.col.r);
+    p.col[1] = to_unorm8(v.col.g);
+    p.col[2] = to_unorm8(v.col.b);
+    p.col[3] = to_unorm8(v.col.a);
+    p.z = to_unorm16(v.pos.z);
+    p.pad = 0;
+  }
+}
+
+PosCol unpack_vertex(const PackedVertex& v, const D3DXVECTOR4& packed)
+{
+  // D3D maps -32768 and -32767 both to -1
+  const float x = v.x < -32767 ? -1 : v.x / 32767.0f;
+  const float y = v.y < -32767 ? -1 : v.y / 32767.0f;
+  return PosCol(
+    D3DXVECTOR3(x * packed.x + packed.z, y * packed.y + packed.w, v.z / 65535.0f),
+    D3DXCOLOR(v.col[0] / 255.0f, v.col[1] / 255.0f, v.col[2] / 255.0f, v.col[3] / 255.0f));
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include "thud_types.hpp"
+
+// A 12 byte alternative to the 28 byte PosCol, for when uploading vertices
+// is the bottleneck. Positions are 16 bit fixed point over a range given by
+// FrameConstants::packed, which Thud sets to the canvas extents plus a
+// screen's worth of guard band on every side, so 1920 pixels wide has a
+// step of about 0.09 pixels. Anything past the guard band is clamped to it.
+// Depth is 16 bit over [0, 1], and colour 8 bits per channel.
+//
+// The layout is R16G16_SNORM position, R8G8B8A8_UNORM colour and R16_UNORM
+// depth, so the input assembler does the decoding.
+struct PackedVertex
+{
+  int16_t x, y;
+  uint8_t col[4];
+  uint16_t z;
+  uint16_t pad;
+};
+
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must match the input layout");
+
+// packed is pos = snorm * packed.xy + packed.zw, see FrameConstants
+void pack_vertices(const PosCol *src, PackedVertex *dst, int n, const D3DXVECTOR4& packed);
+// what the input assembler and vsPacked make of a vertex, before scale
+// and bias, so the same space as the PosCol it was packed from
+PosCol unpack_vertex(const PackedVertex& v, const D3DXVECTOR4& packed);
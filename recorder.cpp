@@ -0,0 +1,167 @@
+#include "stdafx.h"
+#include "recorder.hpp"
+#include "tessellate.hpp"
+#include <algorithm>
+
+using namespace std;
+
+Recorder::Recorder()
+  : _pixels_per_unit(1)
+  , _visible(D3DXVECTOR2(0, 0), D3DXVECTOR2(1, 1))
+  , _num_culled(0)
+  , _indexed(false)
+  , _max_circle_segments(0)
+{
+  _state_stack.push_back(Thud::State());
+}
+
+void Recorder::begin(const ScreenToClip& xform, float pixels_per_unit, const Bounds& visible,
+  bool indexed, int max_circle_segments)
+{
+  _xform = xform;
+  _pixels_per_unit = pixels_per_unit;
+  _visible = visible;
+  _num_culled = 0;
+  _indexed = indexed;
+  _max_circle_segments = max_circle_segments;
+  _state_stack.clear();
+  _state_stack.push_back(Thud::State());
+  // clear keeps the capacity, so after the first frame recording doesn't allocate
+  _verts.clear();
+  _indices.clear();
+  _primitives.clear();
+}
+
+void Recorder::push_state()
+{
+  _state_stack.push_back(Thud::State());
+}
+
+void Recorder::pop_state()
+{
+  _state_stack.pop_back();
+}
+
+void Recorder::set_fill(const D3DXCOLOR& col)
+{
+  _state_stack.back().fill = col;
+}
+
+void Recorder::set_blend(BlendMode mode)
+{
+  _state_stack.back().blend = mode;
+}
+
+void Recorder::set_circle_segments(int num_segments)
+{
+  _state_stack.back().circle_segments = num_segments;
+}
+
+void Recorder::set_circle_tolerance(float max_error_px)
+{
+  _state_stack.back().circle_tolerance = max(0.0f, max_error_px);
+}
+
+void Recorder::set_scissor(const D3DXVECTOR2& top_left, const D3DXVECTOR2& size)
+{
+  Thud::State& state = _state_stack.back();
+  state.scissor = true;
+  state.scissor_bounds = Bounds::corners(
+    D3DXVECTOR3(top_left.x, top_left.y, 0),
+    D3DXVECTOR3(top_left.x + size.x, top_left.y + size.y, 0));
+}
+
+void Recorder::clear_scissor()
+{
+  _state_stack.back().scissor = false;
+}
+
+Bounds Recorder::cull_bounds() const
+{
+  const Thud::State& state = _state_stack.back();
+  return state.scissor ? _visible.intersect(state.scissor_bounds) : _visible;
+}
+
+bool Recorder::cull(const Bounds& b)
+{
+  if (b.overlaps(cull_bounds()))
+    return false;
+  ++_num_culled;
+  return true;
+}
+
+void Recorder::circle(const D3DXVECTOR3& o, float r)
+{
+  const Thud::State& state = _state_stack.back();
+  circle(o, r, state.circle_tolerance > 0
+    ? circle_segments_for_error(r * _pixels_per_unit, state.circle_tolerance)
+    : state.circle_segments);
+}
+
+void Recorder::circle(const D3DXVECTOR3& o, float r, int segments)
+{
+  // clamped like Thud does, so every primitive fits in a canvas chunk, and
+  // like Thud, no segments draws nothing
+  if (segments < 1 || cull(Bounds::corners(o, o).expand(r)))
+    return;
+  segments = min(segments, _max_circle_segments);
+  const Thud::State& state = _state_stack.back();
+  tessellate_circle(*this, _xform, _circle_tables.get(segments), o, r, segments, state.fill);
+}
+
+void Recorder::rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size)
+{
+  // culled and clipped like Thud::rect
+  const Bounds b = Bounds::corners(top_left, top_left + size);
+  const Bounds visible = cull_bounds();
+  if (!b.overlaps(visible)) {
+    ++_num_culled;
+    return;
+  }
+
+  const D3DXCOLOR& col = _state_stack.back().fill;
+  if (!visible.contains(b)) {
+    const Bounds clipped = b.intersect(visible);
+    tessellate_rect(*this, _xform,
+      D3DXVECTOR3(clipped.lo.x, clipped.lo.y, top_left.z),
+      D3DXVECTOR3(clipped.hi.x - clipped.lo.x, clipped.hi.y - clipped.lo.y, size.z), col);
+    return;
+  }
+  tessellate_rect(*this, _xform, top_left, size, col);
+}
+
+void Recorder::line(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, float w)
+{
+  // and like Thud::line, the ends stay just outside the visible area
+  const Bounds visible = cull_bounds().expand(0.5f * w);
+  D3DXVECTOR3 a = p0, b = p1;
+  if (!visible.contains(Bounds::corners(p0, p1)) && !clip_segment(visible, &a, &b)) {
+    ++_num_culled;
+    return;
+  }
+  tessellate_line(*this, _xform, a, b, w, _state_stack.back().fill);
+}
+
+PosCol *Recorder::alloc(int n)
+{
+  void *indices;
+  int base;
+  return alloc_indexed(n, 0, &indices, &base);
+}
+
+PosCol *Recorder::alloc_indexed(int num_verts, int num_indices, void **indices, int *base)
+{
+  Primitive prim;
+  prim.first_vertex = (int)_verts.size();
+  prim.num_verts = num_verts;
+  prim.first_index = (int)_indices.size();
+  prim.num_indices = num_indices;
+  prim.blend = _state_stack.back().blend;
+  _primitives.push_back(prim);
+
+  _verts.resize(prim.first_vertex + num_verts);
+  _indices.resize(prim.first_index + num_indices);
+  *indices = num_indices ? &_indices[prim.first_index] : nullptr;
+  *base = prim.first_vertex;
+  return &_verts[prim.first_vertex];
+}
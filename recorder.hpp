@@ -0,0 +1,85 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <stdint.h>
+#include "thud.hpp"
+
+// Records primitives into its own memory, so several threads can tessellate
+// at the same time, each with a Recorder of its own. The drawing calls mirror
+// the ones on Thud, with a separate State stack. Thud::merge copies the result
+// into the canvas.
+//
+// Rects and lines are always tessellated, Options::instanced and
+// Options::deferred only apply to primitives drawn through Thud directly.
+// Primitives are culled and clipped like Thud's, against the part of the
+// canvas that's visible when begin is called and the recorder's own scissor
+// rect, and merge adds the culled ones to Thud::num_culled.
+class Recorder
+{
+public:
+  Recorder();
+
+  // clears the recorded geometry and the state stack. Thud::begin_recorder
+  // calls this with the current canvas's transform, pixels per unit and
+  // visible bounds, and its options
+  void begin(const ScreenToClip& xform, float pixels_per_unit, const Bounds& visible,
+    bool indexed, int max_circle_segments);
+
+  void push_state();
+  void pop_state();
+
+  void set_fill(const D3DXCOLOR& col);
+  void set_blend(BlendMode mode);
+  void set_circle_segments(int num_segments);
+  void set_circle_tolerance(float max_error_px);
+  void set_scissor(const D3DXVECTOR2& top_left, const D3DXVECTOR2& size);
+  void clear_scissor();
+
+  void circle(const D3DXVECTOR3& o, float r);
+  void circle(const D3DXVECTOR3& o, float r, int segments);
+  void rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size);
+  void line(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, float w);
+
+  // the geometry of one primitive. Indices are 32 bit and relative to
+  // the first recorded vertex
+  struct Primitive
+  {
+    int first_vertex;
+    int num_verts;
+    int first_index;
+    int num_indices;
+    BlendMode blend;
+  };
+
+  const std::vector<PosCol>& verts() const { return _verts; }
+  const std::vector<uint32_t>& indices() const { return _indices; }
+  const std::vector<Primitive>& primitives() const { return _primitives; }
+  // primitives dropped by culling since begin
+  int num_culled() const { return _num_culled; }
+
+  // the output interface the tessellation functions write to
+  PosCol *alloc(int n);
+  PosCol *alloc_indexed(int num_verts, int num_indices, void **indices, int *base);
+  bool indexed() const { return _indexed; }
+  int index_stride() const { return 4; }
+
+private:
+  // the visible bounds, clipped to the scissor rect
+  Bounds cull_bounds() const;
+  // true, and counted, if nothing of a primitive within b is visible
+  bool cull(const Bounds& b);
+
+  ScreenToClip _xform;
+  float _pixels_per_unit;
+  Bounds _visible;
+  int _num_culled;
+  // each recorder has its own tables, as CircleTables builds them lazily
+  CircleTables _circle_tables;
+  bool _indexed;
+  int _max_circle_segments;
+  std::deque<Thud::State> _state_stack;
+  std::vector<PosCol> _verts;
+  std::vector<uint32_t> _indices;
+  std::vector<Primitive> _primitives;
+};
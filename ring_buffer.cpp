@@ -0,0 +1,129 @@
+#include "stdafx.h"
+#include "ring_buffer.hpp"
+#include <algorithm>
+#include <assert.h>
+
+using namespace std;
+
+RingBuffer::RingBuffer()
+  : _backend(nullptr)
+  , _sink(nullptr)
+  , _capacity(0)
+  , _head(0)
+  , _free(0)
+  , _frame_end(0)
+  , _alloc(-1)
+  , _mode(kMapDiscard)
+  , _mapped(false)
+  , _wraps(0)
+  , _discards(0)
+{
+}
+
+bool RingBuffer::init(Backend *backend, VertexSink *sink)
+{
+  _backend = backend;
+  _sink = sink;
+  _capacity = sink->capacity();
+  _head = _free = _frame_end = 0;
+  _alloc = -1;
+  _mapped = false;
+  _wraps = _discards = 0;
+  // enough for the usual frames in flight, so the first few don't allocate
+  _frames.reserve(4);
+  _spare.reserve(4);
+  return _capacity > 0;
+}
+
+void RingBuffer::close()
+{
+  for (size_t i = 0; i < _frames.size(); ++i)
+    delete _frames[i].fence;
+  _frames.clear();
+  for (size_t i = 0; i < _spare.size(); ++i)
+    delete _spare[i];
+  _spare.clear();
+  _sink = nullptr;
+}
+
+void RingBuffer::retire()
+{
+  // fences pass in the order they were inserted, and a discard frees the
+  // frames before it whatever their fences say
+  while (!_frames.empty()) {
+    Frame& frame = _frames.front();
+    if (frame.end > _free && !(frame.fence && frame.fence->passed()))
+      break;
+    _free = max(_free, frame.end);
+    if (frame.fence)
+      _spare.push_back(frame.fence);
+    _frames.erase(_frames.begin());
+  }
+}
+
+bool RingBuffer::fits(int n)
+{
+  retire();
+  const int offset = (int)(_head % _capacity);
+  return !_mapped || (offset + n <= _capacity && _head + n - _free <= _capacity);
+}
+
+int RingBuffer::alloc(int n)
+{
+  assert(n <= _capacity && _alloc < 0);
+  retire();
+
+  int64_t pos = _head;
+  const int offset = (int)(pos % _capacity);
+  if (offset + n > _capacity) {
+    pos += _capacity - offset;
+    ++_wraps;
+  }
+  _mode = kMapNoOverwrite;
+  if (!_mapped || pos + n - _free > _capacity) {
+    // the GPU may still be reading there, so start on fresh memory. The
+    // first map of a buffer has to discard too
+    const int rest = (int)(pos % _capacity);
+    if (rest)
+      pos += _capacity - rest;
+    _free = pos;
+    _mode = kMapDiscard;
+    _discards += _mapped;
+    _mapped = true;
+  }
+  _alloc = pos;
+  return (int)(pos % _capacity);
+}
+
+void *RingBuffer::map()
+{
+  assert(_alloc >= 0);
+  return (char *)_sink->map(_mode) + (_alloc % _capacity) * _sink->stride();
+}
+
+int RingBuffer::unmap(void *end)
+{
+  assert(_alloc >= 0);
+  const int count = _sink->unmap(end);
+  assert(count >= _alloc % _capacity);
+  _head = _alloc - _alloc % _capacity + count;
+  _alloc = -1;
+  return count;
+}
+
+void RingBuffer::end_frame()
+{
+  if (_head == _frame_end)
+    return;
+  Frame frame;
+  if (!_spare.empty()) {
+    frame.fence = _spare.back();
+    _spare.pop_back();
+  } else {
+    frame.fence = _backend->create_fence();
+  }
+  if (frame.fence)
+    frame.fence->insert();
+  frame.end = _frame_end = _head;
+  _frames.push_back(frame);
+}
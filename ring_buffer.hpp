@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "backend.hpp"
+
+// Suballocates one persistent sink as a ring, so writing the next frame
+// doesn't wait for the GPU to let go of the last one. Each alloc takes space
+// at the head, and end_frame puts a fence after everything allocated since
+// the previous end_frame, which frees it once the GPU has passed the fence.
+//
+// Allocations are mapped with no-overwrite. One that doesn't fit before the
+// end of the sink goes back to the start, and if the GPU isn't done with the
+// space there, or the head has caught up with the oldest frame in flight, it
+// maps with discard, so the driver hands over fresh memory instead of the
+// CPU waiting. A discard drops whatever hasn't been drawn yet, so draw
+// everything written before an alloc that fits says doesn't carry on.
+class RingBuffer
+{
+public:
+  RingBuffer();
+
+  // the ring doesn't own the sink
+  bool init(Backend *backend, VertexSink *sink);
+  void close();
+
+  // whether alloc(n) would carry on from the last allocation, rather than go
+  // back to the start or discard
+  bool fits(int n);
+  // reserves n <= capacity() contiguous elements and returns the first
+  int alloc(int n);
+  // the allocation, mapped with the mode alloc picked
+  void *map();
+  // end is one past the last element written, and the rest of the
+  // allocation is given back. Returns the end as an element of the sink
+  int unmap(void *end);
+
+  // fence the allocations since the last end_frame, after their draws
+  void end_frame();
+
+  int capacity() const { return _capacity; }
+  // allocations that went back to the start, and the ones that discarded,
+  // since init
+  int wraps() const { return _wraps; }
+  int discards() const { return _discards; }
+  // frames whose fences haven't passed yet
+  int frames_in_flight() const { return (int)_frames.size(); }
+
+private:
+  struct Frame
+  {
+    // null if the backend couldn't make one, and then the frame is only
+    // freed by a discard
+    Fence *fence;
+    int64_t end;
+  };
+
+  // free the frames whose fences have passed
+  void retire();
+
+  Backend *_backend;
+  VertexSink *_sink;
+  int _capacity;
+  // Positions count elements allocated since init, including the ones
+  // skipped at the end of the sink, so they only grow, and the element is
+  // the position modulo the capacity
+  int64_t _head;
+  // the GPU is done with everything before this
+  int64_t _free;
+  // where the last end_frame was
+  int64_t _frame_end;
+  // the current allocation, or -1
+  int64_t _alloc;
+  MapMode _mode;
+  bool _mapped;
+  // oldest first. There are only ever a few, and a vector doesn't allocate
+  // once it's grown, where a deque would
+  std::vector<Frame> _frames;
+  std::vector<Fence *> _spare;
+  int _wraps;
+  int _discards;
+};
@@ -0,0 +1,96 @@
+#include "stdafx.h"
+#include "screen_to_clip.hpp"
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__AVX__)
+#define THUD_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THUD_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+ScreenToClip::ScreenToClip()
+  : screen_extents(1, 1)
+  , pixel_extents(1, 1)
+  , clip_origin(0, 0)
+  , clip_extents(2, 2)
+  , scale(1, 1)
+  , bias(0, 0)
+{
+}
+
+void ScreenToClip::update()
+{
+	// cx=(2*(sx-cex/2))/sex
+	// cy=(2*(sey/2-sy))/sey
+  // folded into cx = sx * scale.x + bias.x, so to_clip doesn't divide
+
+  scale = D3DXVECTOR2(2 / screen_extents.x, -2 / screen_extents.y);
+  bias = D3DXVECTOR2(-clip_extents.x / 2, clip_extents.y / 2);
+}
+
+D3DXVECTOR2 ScreenToClip::to_screen(float x, float y) const
+{
+	// sx=(cx*sex+cex)/2
+	// sy=-((cy-1)*sey)/2
+
+	return D3DXVECTOR2(
+		(x * screen_extents.x + clip_extents.x)/2,
+		-((y - 1) * screen_extents.y)/ 2);
+
+}
+
+float ScreenToClip::pixels_per_unit() const
+{
+  return max(pixel_extents.x / screen_extents.x, pixel_extents.y / screen_extents.y);
+}
+
+void ScreenToClip::to_clip_scalar(const D3DXVECTOR2 *src, D3DXVECTOR2 *dst, int n) const
+{
+  const float sx = scale.x, sy = scale.y;
+  const float bx = bias.x, by = bias.y;
+  for (int i = 0; i < n; ++i) {
+    const float x = src[i].x, y = src[i].y;
+    dst[i].x = x * sx + bx;
+    dst[i].y = y * sy + by;
+  }
+}
+
+void ScreenToClip::to_clip(const D3DXVECTOR2 *src, D3DXVECTOR2 *dst, int n) const
+{
+  // the points are interleaved x,y pairs, so the scale and bias registers
+  // are too, and each lane does a single multiply-add
+  const float *s = &src[0].x;
+  float *d = &dst[0].x;
+  int i = 0;
+
+#if defined(THUD_AVX)
+  const __m256 vscale = _mm256_setr_ps(scale.x, scale.y, scale.x, scale.y, scale.x, scale.y, scale.x, scale.y);
+  const __m256 vbias = _mm256_setr_ps(bias.x, bias.y, bias.x, bias.y, bias.x, bias.y, bias.x, bias.y);
+  for (; i + 8 <= n; i += 8) {
+    const __m256 a = _mm256_loadu_ps(s + 2 * i + 0);
+    const __m256 b = _mm256_loadu_ps(s + 2 * i + 8);
+#if defined(__FMA__)
+    _mm256_storeu_ps(d + 2 * i + 0, _mm256_fmadd_ps(a, vscale, vbias));
+    _mm256_storeu_ps(d + 2 * i + 8, _mm256_fmadd_ps(b, vscale, vbias));
+#else
+    _mm256_storeu_ps(d + 2 * i + 0, _mm256_add_ps(_mm256_mul_ps(a, vscale), vbias));
+    _mm256_storeu_ps(d + 2 * i + 8, _mm256_add_ps(_mm256_mul_ps(b, vscale), vbias));
+#endif
+  }
+#elif defined(THUD_SSE2)
+  const __m128 vscale = _mm_setr_ps(scale.x, scale.y, scale.x, scale.y);
+  const __m128 vbias = _mm_setr_ps(bias.x, bias.y, bias.x, bias.y);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 a = _mm_loadu_ps(s + 2 * i + 0);
+    const __m128 b = _mm_loadu_ps(s + 2 * i + 4);
+    _mm_storeu_ps(d + 2 * i + 0, _mm_add_ps(_mm_mul_ps(a, vscale), vbias));
+    _mm_storeu_ps(d + 2 * i + 4, _mm_add_ps(_mm_mul_ps(b, vscale), vbias));
+  }
+#endif
+
+  to_clip_scalar(src + i, dst + i, n - i);
+}
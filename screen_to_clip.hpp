@@ -0,0 +1,36 @@
+#pragma once
+
+#include "thud_types.hpp"
+
+struct ScreenToClip
+{
+  ScreenToClip();
+
+  // recompute scale and bias, call after changing the extents
+  void update();
+
+  // clip = screen * scale + bias
+  D3DXVECTOR2 to_clip(float x, float y) const
+  {
+    return D3DXVECTOR2(x * scale.x + bias.x, y * scale.y + bias.y);
+  }
+
+  D3DXVECTOR2 to_screen(float x, float y) const;
+
+  // transform n points. src and dst may be the same array
+  void to_clip(const D3DXVECTOR2 *src, D3DXVECTOR2 *dst, int n) const;
+  // portable version of the above, used for the tail of the simd loops
+  void to_clip_scalar(const D3DXVECTOR2 *src, D3DXVECTOR2 *dst, int n) const;
+
+  // how many render target pixels one screen unit covers
+  float pixels_per_unit() const;
+
+  D3DXVECTOR2 screen_extents;
+  // size of the render target in pixels
+  D3DXVECTOR2 pixel_extents;
+  D3DXVECTOR2 clip_origin;
+  D3DXVECTOR2 clip_extents;
+
+  D3DXVECTOR2 scale;
+  D3DXVECTOR2 bias;
+};
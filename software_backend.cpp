@@ -0,0 +1,361 @@
+#include "stdafx.h"
+#include "software_backend.hpp"
+#include "task_pool.hpp"
+#include "instrument.hpp"
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <stdio.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define THUD_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+  const int kTileSize = 64;
+
+  uint32_t pack_color(const D3DXCOLOR& col)
+  {
+    const float c[] = { col.r, col.g, col.b, col.a };
+    uint32_t packed = 0;
+    for (int i = 0; i < 4; ++i)
+      packed |= (uint32_t)(max(0.0f, min(1.0f, c[i])) * 255 + 0.5f) << (8 * i);
+    return packed;
+  }
+
+  // src * a + dst * (1 - a), or src * a + dst, per 8 bit colour channel.
+  // Alpha is a + dst_a * (1 - a) in both modes, like the blend states of
+  // the D3D11 backend
+  uint32_t blend_pixel(uint32_t src, uint32_t dst, BlendMode blend)
+  {
+    const uint32_t a = src >> 24;
+    uint32_t out = 0;
+    for (int i = 0; i < 24; i += 8) {
+      const uint32_t s = (src >> i) & 0xff;
+      const uint32_t d = (dst >> i) & 0xff;
+      const uint32_t v = blend == kBlendAlpha
+        ? (s * a + d * (255 - a) + 127) / 255
+        : min(255u, (s * a + 127) / 255 + d);
+      out |= v << i;
+    }
+    const uint32_t da = dst >> 24;
+    return out | (a + (da * (255 - a) + 127) / 255) << 24;
+  }
+
+  uint32_t scale_alpha(uint32_t col, float s)
+  {
+    return (col & 0xffffff) | (uint32_t)((col >> 24) * s + 0.5f) << 24;
+  }
+}
+
+SoftwareBackend::SoftwareBackend(int width, int height, int num_threads)
+  : HeadlessBackend(width, height)
+  , clear_color(0, 0, 0, 0)
+  , num_rasterized(0)
+  , num_fragments(0)
+  , _width(width)
+  , _height(height)
+  // rows are padded, so the simd loops can always work on 4 pixels
+  , _pitch((width + 3) & ~3)
+  , _tiles_x((width + kTileSize - 1) / kTileSize)
+  , _tiles_y((height + kTileSize - 1) / kTileSize)
+  , _color(_pitch * height)
+  , _depth(_pitch * height)
+  , _bins(_tiles_x * _tiles_y)
+  , _tile_fragments(_tiles_x * _tiles_y)
+  , _pool(new TaskPool(num_threads))
+{
+}
+
+SoftwareBackend::~SoftwareBackend()
+{
+  delete _pool;
+}
+
+void SoftwareBackend::start_frame(const FrameConstants& c)
+{
+  HeadlessBackend::start_frame(c);
+  _triangles.clear();
+  _shapes.clear();
+  fill(_color.begin(), _color.end(), pack_color(clear_color));
+  fill(_depth.begin(), _depth.end(), 1.0f);
+}
+
+void SoftwareBackend::draw(VertexSink *sink, int first, int count)
+{
+  HeadlessBackend::draw(sink, first, count);
+  setup_draw();
+}
+
+void SoftwareBackend::draw_indexed(VertexSink *verts, VertexSink *indices, int first, int count, int base_vertex)
+{
+  HeadlessBackend::draw_indexed(verts, indices, first, count, base_vertex);
+  setup_draw();
+}
+
+void SoftwareBackend::draw_instanced(InstanceKind kind, VertexSink *instances, int first, int count)
+{
+  HeadlessBackend::draw_instanced(kind, instances, first, count);
+  setup_draw();
+}
+
+void SoftwareBackend::setup_draw()
+{
+  // the constants can change between draws, so the vertices go to pixels
+  // now rather than in rasterize
+  const DrawCall& call = draws.back();
+  const float w = (float)_width, h = (float)_height;
+
+  // the quads of a shape draw are 6 vertices per shape, in order
+  const int first_shape = (int)_shapes.size();
+  if (call.first_shape >= 0) {
+    const D3DXVECTOR4& s2c = constants.screen_to_clip;
+    const D3DXVECTOR4& pixel = constants.pixel_size;
+    for (int i = 0; i < call.count / 6; ++i) {
+      const ShapeInstance& inst = shapes[call.first_shape + i];
+      Shape shape;
+      shape.x = ((inst.centre.x * s2c.x + s2c.z) * 0.5f + 0.5f) * w;
+      shape.y = (0.5f - (inst.centre.y * s2c.y + s2c.w) * 0.5f) * h;
+      shape.radii = D3DXVECTOR2(inst.radii.x / pixel.x, inst.radii.y / pixel.y);
+      shape.corner = inst.corner < 0 ? -1 : inst.corner * 2 / (pixel.x + pixel.y);
+      _shapes.push_back(shape);
+    }
+  }
+
+  for (int i = call.first; i + 3 <= call.first + call.count; i += 3) {
+    float x[3], y[3], z[3];
+    for (int k = 0; k < 3; ++k) {
+      const D3DXVECTOR3 p = to_clip(vertices[i + k].pos);
+      x[k] = (p.x * 0.5f + 0.5f) * w;
+      y[k] = (0.5f - p.y * 0.5f) * h;
+      z[k] = p.z;
+    }
+
+    // y points down, so clockwise triangles, the front faces, have a
+    // positive area. Back faces and slivers are dropped
+    const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(area > 0))
+      continue;
+
+    Triangle tri;
+    tri.x0 = max(0, (int)floorf(min(x[0], min(x[1], x[2]))));
+    tri.y0 = max(0, (int)floorf(min(y[0], min(y[1], y[2]))));
+    tri.x1 = min(_width, (int)ceilf(max(x[0], max(x[1], x[2]))) + 1);
+    tri.y1 = min(_height, (int)ceilf(max(y[0], max(y[1], y[2]))) + 1);
+    if (tri.x0 >= tri.x1 || tri.y0 >= tri.y1)
+      continue;
+
+    // edge k runs from vertex k to k+1. E is positive on the inside, and
+    // scaled by 1/area, so the edges are the barycentrics of the opposite
+    // vertices
+    const float inv_area = 1 / area;
+    for (int k = 0; k < 3; ++k) {
+      const int n = (k + 1) % 3;
+      const float dx = x[n] - x[k], dy = y[n] - y[k];
+      tri.a[k] = -dy * inv_area;
+      tri.b[k] = dx * inv_area;
+      tri.c[k] = (dy * x[k] - dx * y[k]) * inv_area;
+      // on a clockwise triangle with y down, left edges go up, and top
+      // edges are flat and go right. Pixels on other edges belong to the
+      // neighbouring triangle
+      const bool top_left = dy < 0 || (dy == 0 && dx > 0);
+      tri.bias[k] = top_left ? 0 : numeric_limits<float>::denorm_min();
+      // the pixel x where the edge crosses row y, from E(x + 0.5, y) = bias
+      if (dy != 0) {
+        tri.span_dx[k] = dx / dy;
+        tri.span_x[k] = x[k] - tri.span_dx[k] * y[k] - 0.5f;
+      } else {
+        tri.span_dx[k] = tri.span_x[k] = 0;
+      }
+    }
+    // edge k is the barycentric of the vertex opposite it, k+2
+    tri.za = tri.a[1] * z[0] + tri.a[2] * z[1] + tri.a[0] * z[2];
+    tri.zb = tri.b[1] * z[0] + tri.b[2] * z[1] + tri.b[0] * z[2];
+    tri.zc = tri.c[1] * z[0] + tri.c[2] * z[1] + tri.c[0] * z[2];
+    tri.color = pack_color(vertices[i].col);
+    tri.blend = call.blend;
+    tri.shape = call.first_shape >= 0 ? first_shape + (i - call.first) / 6 : -1;
+    _triangles.push_back(tri);
+  }
+}
+
+bool SoftwareBackend::overlaps(const Triangle& tri, int tile_x0, int tile_y0)
+{
+  // a long diagonal triangle has a bounding box over many tiles it doesn't
+  // touch. The tile is outside if, for some edge, the pixel centre where
+  // that edge is largest is still outside
+  const float x0 = tile_x0 + 0.5f, x1 = tile_x0 + kTileSize - 0.5f;
+  const float y0 = tile_y0 + 0.5f, y1 = tile_y0 + kTileSize - 0.5f;
+  for (int k = 0; k < 3; ++k) {
+    const float x = tri.a[k] > 0 ? x1 : x0;
+    const float y = tri.b[k] > 0 ? y1 : y0;
+    if (tri.a[k] * x + tri.b[k] * y + tri.c[k] < tri.bias[k])
+      return false;
+  }
+  return true;
+}
+
+void SoftwareBackend::rasterize()
+{
+  THUD_TRACE("SoftwareBackend::rasterize");
+  for (size_t t = 0; t < _bins.size(); ++t)
+    _bins[t].clear();
+  for (size_t i = 0; i < _triangles.size(); ++i) {
+    const Triangle& tri = _triangles[i];
+    const int tx1 = (tri.x1 - 1) / kTileSize, ty1 = (tri.y1 - 1) / kTileSize;
+    for (int ty = tri.y0 / kTileSize; ty <= ty1; ++ty)
+      for (int tx = tri.x0 / kTileSize; tx <= tx1; ++tx)
+        if (overlaps(tri, tx * kTileSize, ty * kTileSize))
+          _bins[ty * _tiles_x + tx].push_back((uint32_t)i);
+  }
+
+  for (int t = 0; t < (int)_bins.size(); ++t) {
+    _tile_fragments[t] = 0;
+    if (!_bins[t].empty())
+      _pool->push([this, t] { raster_tile(t); });
+  }
+  _pool->wait();
+
+  num_rasterized = (int)_triangles.size();
+  num_fragments = 0;
+  for (size_t t = 0; t < _tile_fragments.size(); ++t)
+    num_fragments += _tile_fragments[t];
+}
+
+void SoftwareBackend::raster_tile(int tile)
+{
+  THUD_TRACE("SoftwareBackend::raster_tile");
+  const int tile_x0 = (tile % _tiles_x) * kTileSize;
+  const int tile_y0 = (tile / _tiles_x) * kTileSize;
+  const int tile_x1 = min(_width, tile_x0 + kTileSize);
+  const int tile_y1 = min(_height, tile_y0 + kTileSize);
+  const vector<uint32_t>& bin = _bins[tile];
+  int64_t fragments = 0;
+
+  for (size_t i = 0; i < bin.size(); ++i) {
+    const Triangle& tri = _triangles[bin[i]];
+    const int tri_x0 = max(tri.x0, tile_x0);
+    const int tri_x1 = min(tri.x1, tile_x1);
+    const int y0 = max(tri.y0, tile_y0);
+    const int y1 = min(tri.y1, tile_y1);
+
+    for (int y = y0; y < y1; ++y) {
+      const float py = y + 0.5f;
+      // the bounding box of a long thin triangle is mostly empty, so each
+      // row only visits the span the edges allow, widened by a pixel to
+      // stay conservative. The edge tests below decide the exact coverage
+      float lo = (float)tri_x0, hi = (float)tri_x1;
+      for (int k = 0; k < 3; ++k) {
+        const float cross = tri.span_x[k] + tri.span_dx[k] * py;
+        if (tri.a[k] > 0)
+          lo = max(lo, floorf(cross) - 1);
+        else if (tri.a[k] < 0)
+          hi = min(hi, ceilf(cross) + 2);
+        else if (tri.b[k] * py + tri.c[k] < tri.bias[k])
+          hi = lo;
+      }
+      if (lo >= hi)
+        continue;
+      const int x1 = (int)hi;
+
+      uint32_t *color = &_color[y * _pitch];
+      float *depth = &_depth[y * _pitch];
+      int x = (int)lo & ~3;
+
+#if defined(THUD_SSE2)
+      // evaluated at every step rather than stepped, so the result doesn't
+      // drift across a tile, and matches the scalar loop bit for bit
+      // the tiles are multiples of 4 wide, so starting on a multiple of 4
+      // keeps the simd loop inside the tile
+      __m128 a[3], row[3], bias[3];
+      for (int k = 0; k < 3; ++k) {
+        a[k] = _mm_set1_ps(tri.a[k]);
+        row[k] = _mm_set1_ps(tri.b[k] * py + tri.c[k]);
+        bias[k] = _mm_set1_ps(tri.bias[k]);
+      }
+      const __m128 za = _mm_set1_ps(tri.za);
+      const __m128 zrow = _mm_set1_ps(tri.zb * py + tri.zc);
+      const __m128i vcolor = _mm_set1_epi32((int)tri.color);
+      const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+      __m128 px = _mm_setr_ps(x + 0.5f, x + 1.5f, x + 2.5f, x + 3.5f);
+      // shapes take the scalar loop, for their coverage
+      const int simd_x1 = tri.shape < 0 ? x1 : x;
+
+      for (; x < simd_x1; x += 4) {
+        // lanes past x1 belong to the next tile, or the row padding
+        __m128 mask = _mm_castsi128_ps(_mm_cmplt_epi32(lane, _mm_set1_epi32(x1 - x)));
+        for (int k = 0; k < 3; ++k)
+          mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[k], px), row[k]), bias[k]));
+        const __m128 z = _mm_add_ps(_mm_mul_ps(za, px), zrow);
+        const __m128 d = _mm_loadu_ps(depth + x);
+        mask = _mm_and_ps(mask, _mm_cmple_ps(z, d));
+
+        const int bits = _mm_movemask_ps(mask);
+        if (bits) {
+          _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, d)));
+          if (tri.blend == kBlendDefault) {
+            const __m128i m = _mm_castps_si128(mask);
+            const __m128i dst = _mm_loadu_si128((const __m128i *)(color + x));
+            _mm_storeu_si128((__m128i *)(color + x), _mm_or_si128(_mm_and_si128(m, vcolor), _mm_andnot_si128(m, dst)));
+          } else {
+            for (int k = 0; k < 4; ++k)
+              if (bits & (1 << k))
+                color[x + k] = blend_pixel(tri.color, color[x + k], tri.blend);
+          }
+          // popcount of 4 bits
+          fragments += (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + (bits >> 3);
+        }
+
+        px = _mm_add_ps(px, _mm_set1_ps(4));
+      }
+#endif
+
+      for (; x < x1; ++x) {
+        const float fx = x + 0.5f;
+        bool inside = true;
+        for (int k = 0; k < 3; ++k)
+          inside = inside && tri.a[k] * fx + (tri.b[k] * py + tri.c[k]) >= tri.bias[k];
+        const float z = tri.za * fx + (tri.zb * py + tri.zc);
+        if (!inside || !(z <= depth[x]))
+          continue;
+        uint32_t src = tri.color;
+        if (tri.shape >= 0) {
+          // uncovered pixels are discarded, depth and all
+          const Shape& s = _shapes[tri.shape];
+          const float d = shape_distance(D3DXVECTOR2(fx - s.x, py - s.y), s.radii, s.corner);
+          const float coverage = shape_coverage(d, tri.blend != kBlendDefault);
+          if (!(coverage > 0))
+            continue;
+          src = scale_alpha(src, coverage);
+        }
+        depth[x] = z;
+        color[x] = tri.blend == kBlendDefault ? src : blend_pixel(src, color[x], tri.blend);
+        ++fragments;
+      }
+    }
+  }
+  _tile_fragments[tile] = fragments;
+}
+
+bool SoftwareBackend::save_ppm(const char *path) const
+{
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+  fprintf(f, "P6\n%d %d\n255\n", _width, _height);
+  vector<unsigned char> row(3 * _width);
+  for (int y = 0; y < _height; ++y) {
+    const uint32_t *src = &_color[y * _pitch];
+    for (int x = 0; x < _width; ++x) {
+      row[3 * x + 0] = (unsigned char)(src[x] >> 0);
+      row[3 * x + 1] = (unsigned char)(src[x] >> 8);
+      row[3 * x + 2] = (unsigned char)(src[x] >> 16);
+    }
+    fwrite(&row[0], 1, row.size(), f);
+  }
+  return fclose(f) == 0;
+}
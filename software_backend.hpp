@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "headless_backend.hpp"
+
+class TaskPool;
+
+// A HeadlessBackend that also rasterizes what it's given, for running the
+// whole pipeline on machines without a GPU, and for rendering thumbnails.
+//
+// Every draw is set up as it comes in: transformed to pixels, back faces
+// dropped like the D3D11 default rasterizer state, and edge functions and a
+// depth plane computed. rasterize() then bins the triangles into 64x64 pixel
+// tiles, and fills the tiles on a TaskPool, each tile on one thread, so they
+// need no locking. Coverage follows the top-left rule. Each pixel is depth
+// tested less-or-equal and written with the triangle's flat colour and blend
+// mode, so the result matches the psMain shader for Thud's single colour
+// primitives. The quads of ShapeInstances go through shape_distance and
+// shape_coverage per pixel instead, like psShape.
+class SoftwareBackend : public HeadlessBackend
+{
+public:
+  // num_threads workers besides the thread calling rasterize
+  SoftwareBackend(int width, int height, int num_threads = 0);
+  ~SoftwareBackend();
+
+  // also clears the colour buffer to clear_color and the depth buffer to 1
+  virtual void start_frame(const FrameConstants& constants);
+  virtual void draw(VertexSink *sink, int first, int count);
+  virtual void draw_indexed(VertexSink *verts, VertexSink *indices, int first, int count, int base_vertex);
+  virtual void draw_instanced(InstanceKind kind, VertexSink *instances, int first, int count);
+
+  // fill everything drawn since start_frame, call after Thud::render
+  void rasterize();
+
+  int width() const { return _width; }
+  int height() const { return _height; }
+  // rows of pitch() pixels, each 0xAABBGGRR, ie R8G8B8A8 in memory
+  const uint32_t *pixels() const { return &_color[0]; }
+  int pitch() const { return _pitch; }
+  bool save_ppm(const char *path) const;
+
+  D3DXCOLOR clear_color;
+  // from the last rasterize, the triangles left after culling, and the
+  // pixels that passed the coverage and depth tests
+  int num_rasterized;
+  int64_t num_fragments;
+
+private:
+  // E(x, y) = a * x + b * y + c at pixel centres, >= 0 inside for each edge,
+  // and > 0 for edges that aren't top or left, which is what bias is for
+  struct Triangle
+  {
+    float a[3], b[3], c[3], bias[3];
+    // the x where each edge crosses a row is span_x + span_dx * y
+    float span_x[3], span_dx[3];
+    float za, zb, zc;
+    int x0, y0, x1, y1;
+    uint32_t color;
+    BlendMode blend;
+    // index into _shapes for the quad of a shape, or -1
+    int shape;
+  };
+
+  // a ShapeInstance in pixels
+  struct Shape
+  {
+    float x, y;
+    D3DXVECTOR2 radii;
+    float corner;
+  };
+
+  // set up the vertices the last draw appended
+  void setup_draw();
+  static bool overlaps(const Triangle& tri, int tile_x0, int tile_y0);
+  void raster_tile(int tile);
+
+  int _width;
+  int _height;
+  int _pitch;
+  int _tiles_x;
+  int _tiles_y;
+  std::vector<uint32_t> _color;
+  std::vector<float> _depth;
+  std::vector<Triangle> _triangles;
+  std::vector<Shape> _shapes;
+  // triangle indices per tile, in draw order
+  std::vector<std::vector<uint32_t> > _bins;
+  std::vector<int64_t> _tile_fragments;
+  TaskPool *_pool;
+};
@@ -0,0 +1,102 @@
+#include "stdafx.h"
+#include "task_pool.hpp"
+
+TaskPool::TaskPool(int num_threads)
+  : _queued(0)
+  , _pending(0)
+  , _next(0)
+  , _quit(false)
+{
+  for (int i = 0; i <= num_threads; ++i)
+    _queues.push_back(new Queue());
+  for (int i = 0; i < num_threads; ++i)
+    _threads.push_back(std::thread(&TaskPool::worker, this, i));
+}
+
+TaskPool::~TaskPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _quit = true;
+  }
+  _wake.notify_all();
+  for (size_t i = 0; i < _threads.size(); ++i)
+    _threads[i].join();
+  for (size_t i = 0; i < _queues.size(); ++i)
+    delete _queues[i];
+}
+
+void TaskPool::push(const Task& task)
+{
+  ++_pending;
+  Queue& queue = *_queues[_next];
+  _next = (_next + 1) % (int)_queues.size();
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+  }
+  {
+    // under _mutex, so a worker can't miss the wakeup between checking
+    // _queued and going to sleep
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_queued;
+  }
+  _wake.notify_one();
+}
+
+bool TaskPool::pop(int idx, Task *task)
+{
+  const int n = (int)_queues.size();
+  for (int i = 0; i < n; ++i) {
+    Queue& queue = *_queues[(idx + i) % n];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      continue;
+    if (i == 0) {
+      *task = queue.tasks.back();
+      queue.tasks.pop_back();
+    } else {
+      *task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+    --_queued;
+    return true;
+  }
+  return false;
+}
+
+void TaskPool::worker(int idx)
+{
+  Task task;
+  for (;;) {
+    if (pop(idx, &task)) {
+      task();
+      task = Task();
+      if (--_pending == 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _wake.wait(lock, [this] { return _quit || _queued > 0; });
+    if (_quit)
+      return;
+  }
+}
+
+void TaskPool::wait()
+{
+  // help out until the deques are empty, then wait for the tasks still running
+  const int idx = (int)_queues.size() - 1;
+  Task task;
+  while (pop(idx, &task)) {
+    task();
+    task = Task();
+    --_pending;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _done.wait(lock, [this] { return _pending == 0; });
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads with a task deque each. Tasks are pushed round
+// robin, a worker takes from the back of its own deque, and when that runs dry
+// it steals from the front of the others, so a few slow tasks don't leave the
+// rest of the pool idle. The thread calling wait() works through the deques
+// too, so a pool with 0 threads runs everything in wait().
+class TaskPool
+{
+public:
+  typedef std::function<void ()> Task;
+
+  explicit TaskPool(int num_threads);
+  ~TaskPool();
+
+  void push(const Task& task);
+  // returns when every task pushed so far has finished
+  void wait();
+
+  int num_threads() const { return (int)_threads.size(); }
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void worker(int idx);
+  // own deque first, then the others starting at the next one
+  bool pop(int idx, Task *task);
+
+  std::vector<std::thread> _threads;
+  // one per worker, plus one for the thread in wait()
+  std::vector<Queue *> _queues;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  // tasks sitting in the deques, and tasks not yet finished
+  std::atomic<int> _queued;
+  std::atomic<int> _pending;
+  int _next;
+  bool _quit;
+};
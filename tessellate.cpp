@@ -0,0 +1,20 @@
+#include "stdafx.h"
+#include "tessellate.hpp"
+
+int circle_segments_for_error(float r_px, float max_error_px)
+{
+  // The largest distance between a chord and the arc it cuts off is
+  // r * (1 - cos(pi/n)), so we need n >= pi / acos(1 - e/r). acos(1-x) >= sqrt(2x),
+  // which gives the slightly conservative n >= pi * sqrt(r / 2e).
+  // The result is rounded up to one of a few counts, so circles of similar
+  // size share the same table.
+  static const int levels[] = { 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+  const int num_levels = sizeof(levels) / sizeof(levels[0]);
+
+  const float n = (float)kPi * sqrtf(r_px / (2 * max_error_px));
+  for (int i = 0; i < num_levels; ++i) {
+    if (n <= levels[i])
+      return levels[i];
+  }
+  return levels[num_levels - 1];
+}
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include "thud_types.hpp"
+#include "screen_to_clip.hpp"
+
+// The tessellation shared by Thud and the Recorders. Each function writes one
+// primitive to out, which is anything with
+//
+//   PosCol *alloc(int n);
+//   PosCol *alloc_indexed(int num_verts, int num_indices, void **indices, int *base);
+//   bool indexed() const;
+//   int index_stride() const;
+//
+// and transforms the vertices with xform on the way.
+
+// writes 16 or 32 bit indices, offset by the base vertex of the allocation
+struct IndexWriter
+{
+  IndexWriter(void *ptr, int stride, int base)
+    : _ptr16((uint16_t *)ptr)
+    , _ptr32((uint32_t *)ptr)
+    , _wide(stride == 4)
+    , _base(base)
+  {
+  }
+
+  void operator()(int i)
+  {
+    if (_wide)
+      *_ptr32++ = (uint32_t)(_base + i);
+    else
+      *_ptr16++ = (uint16_t)(_base + i);
+  }
+
+  uint16_t *_ptr16;
+  uint32_t *_ptr32;
+  bool _wide;
+  int _base;
+};
+
+// the segment count that keeps the rim of a circle with radius r_px pixels
+// within max_error_px of the true circle
+int circle_segments_for_error(float r_px, float max_error_px);
+
+// dir is the unit circle table for segments, see CircleTables. radii are
+// half the width and height
+template<class Target>
+void tessellate_ellipse(Target& out, const ScreenToClip& xform, const D3DXVECTOR2 *dir,
+  const D3DXVECTOR3& o, const D3DXVECTOR2& radii, int segments, const D3DXCOLOR& col)
+{
+  // to_clip is affine, so the rim is the clip space centre plus the
+  // unit directions scaled by the radii in clip space
+  const D3DXVECTOR2 c = xform.to_clip(o.x, o.y);
+  const float rx = radii.x * xform.scale.x;
+  const float ry = radii.y * xform.scale.y;
+
+  if (out.indexed()) {
+    // the centre followed by the rim, fanned out with indices
+    void *idx;
+    int base;
+    PosCol *ptr = out.alloc_indexed(segments + 1, 3 * segments, &idx, &base);
+    IndexWriter indices(idx, out.index_stride(), base);
+    *ptr++ = PosCol(c, o.z, col);
+    for (int i = 0; i < segments; ++i) {
+      *ptr++ = PosCol(D3DXVECTOR2(c.x + rx * dir[i].x, c.y + ry * dir[i].y), o.z, col);
+      indices(0);
+      indices(1 + i);
+      indices(i + 1 < segments ? 2 + i : 1);
+    }
+    return;
+  }
+
+  PosCol *ptr = out.alloc(3 * segments);
+  D3DXVECTOR2 cur(c.x + rx * dir[0].x, c.y + ry * dir[0].y);
+  for (int i = 0; i < segments; ++i) {
+    const D3DXVECTOR2 next(c.x + rx * dir[i+1].x, c.y + ry * dir[i+1].y);
+    *ptr++ = PosCol(c, o.z, col);
+    *ptr++ = PosCol(cur, o.z, col);
+    *ptr++ = PosCol(next, o.z, col);
+    cur = next;
+  }
+}
+
+template<class Target>
+void tessellate_circle(Target& out, const ScreenToClip& xform, const D3DXVECTOR2 *dir,
+  const D3DXVECTOR3& o, float r, int segments, const D3DXCOLOR& col)
+{
+  tessellate_ellipse(out, xform, dir, o, D3DXVECTOR2(r, r), segments, col);
+}
+
+// A fan from the centre over the four corner arcs, each a quarter of the
+// circle table for segments, which has to be a multiple of 4. Takes
+// segments + 5 vertices and 3 * (segments + 4) indices, or 3 * (segments + 4)
+// vertices. corner is at most the smaller of the radii
+template<class Target>
+void tessellate_rounded_rect(Target& out, const ScreenToClip& xform, const D3DXVECTOR2 *dir,
+  const D3DXVECTOR3& o, const D3DXVECTOR2& radii, float corner, int segments, const D3DXCOLOR& col)
+{
+  // the table runs clockwise on screen from +x, so the first quarter is the
+  // bottom right corner, then bottom left, top left and top right
+  static const float sx[] = { 1, -1, -1, 1 };
+  static const float sy[] = { 1, 1, -1, -1 };
+  const D3DXVECTOR2 c = xform.to_clip(o.x, o.y);
+  const float ix = (radii.x - corner) * xform.scale.x;
+  const float iy = (radii.y - corner) * xform.scale.y;
+  const float rx = corner * xform.scale.x;
+  const float ry = corner * xform.scale.y;
+  const int quarter = segments / 4;
+  const int rim = segments + 4;
+
+  // the point k of corner q
+  auto rim_point = [&](int q, int k) {
+    const D3DXVECTOR2& d = dir[q * quarter + k];
+    return D3DXVECTOR2(c.x + sx[q] * ix + rx * d.x, c.y + sy[q] * iy + ry * d.y);
+  };
+
+  if (out.indexed()) {
+    void *idx;
+    int base;
+    PosCol *ptr = out.alloc_indexed(rim + 1, 3 * rim, &idx, &base);
+    IndexWriter indices(idx, out.index_stride(), base);
+    *ptr++ = PosCol(c, o.z, col);
+    for (int q = 0; q < 4; ++q)
+      for (int k = 0; k <= quarter; ++k)
+        *ptr++ = PosCol(rim_point(q, k), o.z, col);
+    for (int i = 0; i < rim; ++i) {
+      indices(0);
+      indices(1 + i);
+      indices(i + 1 < rim ? 2 + i : 1);
+    }
+  } else {
+    PosCol *ptr = out.alloc(3 * rim);
+    D3DXVECTOR2 cur = rim_point(3, quarter);
+    for (int q = 0; q < 4; ++q) {
+      for (int k = 0; k <= quarter; ++k) {
+        const D3DXVECTOR2 next = rim_point(q, k);
+        *ptr++ = PosCol(c, o.z, col);
+        *ptr++ = PosCol(cur, o.z, col);
+        *ptr++ = PosCol(next, o.z, col);
+        cur = next;
+      }
+    }
+  }
+}
+
+// writes the two triangles given by the 6 corner indices in tris
+template<class Target>
+void tessellate_quad(Target& out, const ScreenToClip& xform,
+  const D3DXVECTOR3& v0, const D3DXVECTOR3& v1, const D3DXVECTOR3& v2, const D3DXVECTOR3& v3,
+  const int *tris, const D3DXCOLOR& col)
+{
+  D3DXVECTOR2 p[] = {
+    D3DXVECTOR2(v0.x, v0.y),
+    D3DXVECTOR2(v1.x, v1.y),
+    D3DXVECTOR2(v2.x, v2.y),
+    D3DXVECTOR2(v3.x, v3.y),
+  };
+  xform.to_clip(p, p, 4);
+  const PosCol v[] = {
+    PosCol(p[0], v0.z, col),
+    PosCol(p[1], v1.z, col),
+    PosCol(p[2], v2.z, col),
+    PosCol(p[3], v3.z, col),
+  };
+
+  if (out.indexed()) {
+    void *idx;
+    int base;
+    PosCol *ptr = out.alloc_indexed(4, 6, &idx, &base);
+    IndexWriter indices(idx, out.index_stride(), base);
+    for (int i = 0; i < 4; ++i)
+      *ptr++ = v[i];
+    for (int i = 0; i < 6; ++i)
+      indices(tris[i]);
+  } else {
+    PosCol *ptr = out.alloc(6);
+    for (int i = 0; i < 6; ++i)
+      *ptr++ = v[tris[i]];
+  }
+}
+
+template<class Target>
+void tessellate_rect(Target& out, const ScreenToClip& xform,
+  const D3DXVECTOR3& top_left, const D3DXVECTOR3& size, const D3DXCOLOR& col)
+{
+	// v0, v1
+	// v2, v3
+	const D3DXVECTOR3 v0 = top_left;
+	const D3DXVECTOR3 v1 = top_left + D3DXVECTOR3(size.x, 0, 0);
+	const D3DXVECTOR3 v2 = top_left + D3DXVECTOR3(0, size.y, 0);
+	const D3DXVECTOR3 v3 = top_left + D3DXVECTOR3(size.x, size.y, 0);
+
+  // v0, v1, v2
+  // v2, v1, v3
+  static const int quad[] = { 0, 1, 2, 2, 1, 3 };
+  tessellate_quad(out, xform, v0, v1, v2, v3, quad, col);
+}
+
+template<class Target>
+void tessellate_line(Target& out, const ScreenToClip& xform,
+  const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, float w, const D3DXCOLOR& col)
+{
+	const D3DXVECTOR3 n0 = vec3_normalize(D3DXVECTOR3(p0.y - p1.y, p1.x - p0.x, 0));
+	const D3DXVECTOR3 n1 = vec3_normalize(D3DXVECTOR3(p1.y - p0.y, p0.x - p1.x, 0));
+
+	// v0, v1
+	// v2, v3
+	const D3DXVECTOR3 v0 = p0 + 0.5f * w * n0;
+	const D3DXVECTOR3 v1 = p1 + 0.5f * w * n0;
+	const D3DXVECTOR3 v2 = p0 + 0.5f * w * n1;
+	const D3DXVECTOR3 v3 = p1 + 0.5f * w * n1;
+
+  // v0, v2, v1
+  // v2, v3, v1
+  static const int quad[] = { 0, 2, 1, 2, 3, 1 };
+  tessellate_quad(out, xform, v0, v1, v2, v3, quad, col);
+}
+
+// how a polyline turns at its interior points
+enum LineJoin
+{
+  // the outer edges are extended until they meet, but never further than
+  // kMiterLimit half widths from the point
+  kJoinMiter,
+  // the outer corner is cut off by a triangle
+  kJoinBevel,
+};
+
+const float kMiterLimit = 4;
+
+// unit normal of the segment a -> b, (-dy, dx) like tessellate_line, or
+// fallback if the segment has no length
+inline D3DXVECTOR2 segment_normal(const D3DXVECTOR3& a, const D3DXVECTOR3& b, const D3DXVECTOR2& fallback)
+{
+  const float dx = b.x - a.x, dy = b.y - a.y;
+  const float len2 = dx * dx + dy * dy;
+  if (len2 == 0)
+    return fallback;
+  const float inv = 1 / sqrtf(len2);
+  return D3DXVECTOR2(-dy * inv, dx * inv);
+}
+
+// Writes triangles over a stream of vertices, either as shared vertices and
+// indices, or as a plain triangle list. vertex returns a handle to pass to
+// triangle, which stays valid for the next 7 vertices
+struct StripWriter
+{
+  StripWriter(PosCol *ptr, bool indexed, const IndexWriter& indices)
+    : _ptr(ptr)
+    , _indexed(indexed)
+    , _indices(indices)
+    , _next(0)
+  {
+  }
+
+  int vertex(const PosCol& v)
+  {
+    if (_indexed)
+      *_ptr++ = v;
+    else
+      _recent[_next & 7] = v;
+    return _next++;
+  }
+
+  void triangle(int a, int b, int c)
+  {
+    if (_indexed) {
+      _indices(a);
+      _indices(b);
+      _indices(c);
+    } else {
+      *_ptr++ = _recent[a & 7];
+      *_ptr++ = _recent[b & 7];
+      *_ptr++ = _recent[c & 7];
+    }
+  }
+
+  // a0, a1 across the start of a segment and b0, b1 across its end, in the
+  // same order as tessellate_line
+  void quad(int a0, int a1, int b0, int b1)
+  {
+    triangle(a0, a1, b0);
+    triangle(a1, b1, b0);
+  }
+
+  PosCol *_ptr;
+  bool _indexed;
+  IndexWriter _indices;
+  PosCol _recent[8];
+  int _next;
+};
+
+// vertices and indices (or list vertices) of points [first, last] of a polyline
+inline int polyline_vertices(int first, int last, LineJoin join)
+{
+  return 2 * (last - first + 1) + (join == kJoinBevel ? last - first - 1 : 0);
+}
+
+inline int polyline_indices(int first, int last, LineJoin join)
+{
+  return 6 * (last - first) + (join == kJoinBevel ? 3 * (last - first - 1) : 0);
+}
+
+// Strokes points [first, last] of the polyline pts[0, n) as one connected
+// mesh, with a pair of vertices across each point and a bevel triangle at
+// each bevelled join. Each segment normal is computed once. The neighbours
+// outside the range are used for the joins at its ends, so a long polyline
+// can be written in pieces that fit a chunk. The ends of a piece are always
+// mitred, and the ends of the polyline are cut square.
+template<class Target>
+void tessellate_polyline(Target& out, const ScreenToClip& xform, const D3DXVECTOR3 *pts, int n,
+  int first, int last, float w, LineJoin join, const D3DXCOLOR& col)
+{
+  const int num_verts = polyline_vertices(first, last, join);
+  const int num_indices = polyline_indices(first, last, join);
+  void *idx = nullptr;
+  int base = 0;
+  PosCol *ptr = out.indexed()
+    ? out.alloc_indexed(num_verts, num_indices, &idx, &base)
+    : out.alloc(num_indices);
+  StripWriter strip(ptr, out.indexed(), IndexWriter(idx, out.index_stride(), base));
+
+  const float hw = 0.5f * w;
+  const float max_miter = kMiterLimit * hw;
+
+  // n_in and n_out are the normals of the segments into and out of point i.
+  // At the ends of the polyline they are the same, which gives a square end
+  D3DXVECTOR2 n_out = segment_normal(pts[first], pts[first + 1], D3DXVECTOR2(0, 0));
+  D3DXVECTOR2 n_in = first > 0 ? segment_normal(pts[first - 1], pts[first], n_out) : n_out;
+  int prev0 = 0, prev1 = 0;
+  for (int i = first; i <= last; ++i) {
+    const D3DXVECTOR3& p = pts[i];
+    if (i > first) {
+      n_in = n_out;
+      n_out = i + 1 < n ? segment_normal(p, pts[i + 1], n_in) : n_in;
+    }
+
+    // the offsets are in screen space, and to_clip is affine, so they are
+    // scaled onto the clip space centre
+    const D3DXVECTOR2 c = xform.to_clip(p.x, p.y);
+    const D3DXVECTOR2 s = xform.scale;
+    auto at = [&](const D3DXVECTOR2& off) {
+      return PosCol(D3DXVECTOR2(c.x + off.x * s.x, c.y + off.y * s.y), p.z, col);
+    };
+
+    // the bisector m is scaled so both edges stay hw from the centre line,
+    // which is hw / cos(half the turn) = 2 hw / |m| along it
+    const D3DXVECTOR2 m = n_in + n_out;
+    const float m2 = m.x * m.x + m.y * m.y;
+    D3DXVECTOR2 miter = hw * n_in;
+    if (m2 > 0)
+      miter = m * (4 * hw * hw <= max_miter * max_miter * m2 ? 2 * hw / m2 : max_miter / sqrtf(m2));
+
+    if (join != kJoinBevel || i == first || i == last) {
+      const int v0 = strip.vertex(at(miter));
+      const int v1 = strip.vertex(at(-miter));
+      if (i > first)
+        strip.quad(prev0, prev1, v0, v1);
+      prev0 = v0;
+      prev1 = v1;
+      continue;
+    }
+
+    // the path turns towards +n when n_out is counterclockwise of n_in, and
+    // the outer corner is on the other side. The inner side is mitred
+    const float side = n_in.x * n_out.y - n_in.y * n_out.x > 0 ? -1.0f : 1.0f;
+    const int inner = strip.vertex(at(-side * miter));
+    const int outer_in = strip.vertex(at(side * hw * n_in));
+    const int outer_out = strip.vertex(at(side * hw * n_out));
+    // the bevel is wound the same way as the quads
+    if (side > 0) {
+      strip.quad(prev0, prev1, outer_in, inner);
+      strip.triangle(inner, outer_out, outer_in);
+      prev0 = outer_out;
+      prev1 = inner;
+    } else {
+      strip.quad(prev0, prev1, inner, outer_in);
+      strip.triangle(inner, outer_in, outer_out);
+      prev0 = inner;
+      prev1 = outer_out;
+    }
+  }
+}
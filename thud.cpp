@@ -1,166 +1,132 @@
 #include "stdafx.h"
-#include <windows.h>
-#include <deque>
-#include <celsus/graphics.hpp>
-#include <celsus/dynamic_vb.hpp>
-#include <celsus/vertex_types.hpp>
-#include <celsus/error2.hpp>
-#include <celsus/Logger.hpp>
-#include <celsus/effect_wrapper.hpp>
-#include <celsus/math_utils.hpp>
-#include <D3DX10math.h>
-#define ANT_TW_SUPPORT_DX11
-#include <libs/AntTweakBar/include/AntTweakBar.h>
+#include "thud.hpp"
+#include "recorder.hpp"
+#include "task_pool.hpp"
+#include "bezier.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
 
 using namespace std;
 
-char shader[] = " "\
-"float4 scale; 											  "\
-"struct psInput												"\
-"{																		"\
-"	float4 pos : SV_Position;						"\
-"	float4 col : Color;									"\
-"};																		"\
-"																			"\
-"struct vsInput												"\
-"{																		"\
-"	float4 pos : SV_Position;						"\
-"	float4 col : Color;									"\
-"};																		"\
-"psInput vsMain(in vsInput v)					"\
-"{																		"\
-"	psInput o = (psInput)0;							"\
-"	o.pos = v.pos * scale;			  "\
-"	o.col = v.col;											"\
-"	return o;														"\
-"}																		"\
-"																			"\
-"float4 psMain(in psInput v) : SV_Target	"\
-"{"\
-"	return v.col;"\
-"}";
+static_assert(FrameStats::kNumKinds == kRoundedRectCommand + 1, "a FrameStats::primitives entry per CommandKind");
 
-struct ScreenToClip
+bool Thud::Canvas::init(Backend *backend, const Options& options, FrameStats *stats)
 {
-	D3DXVECTOR2 to_clip(float x, float y);
-	D3DXVECTOR2 to_screen(float x, float y);
-
-	D3DXVECTOR2 screen_extents;
-	D3DXVECTOR2 clip_origin;
-	D3DXVECTOR2 clip_extents;
-};
+  const int index_chunk_size = options.indexed ? 3 * options.chunk_size : 0;
+  const int flags = (options.packed_vertices ? VertexArena::kPacked : 0) | (options.ring_buffer ? VertexArena::kRing : 0);
+  if (!verts.init(backend, sizeof(PosCol), options.chunk_size, options.max_chunks, index_chunk_size, flags))
+    return false;
+  verts.set_constants(&constants);
+  verts.set_stats(stats);
+
+  if (options.instanced) {
+    if (!rects.init_instances(backend, kRectInstance, sizeof(RectInstance), options.chunk_size, options.max_chunks))
+      return false;
+    if (!lines.init_instances(backend, kLineInstance, sizeof(LineInstance), options.chunk_size, options.max_chunks))
+      return false;
+    rects.set_constants(&constants);
+    lines.set_constants(&constants);
+    rects.set_stats(stats);
+    lines.set_stats(stats);
+  }
+  if (options.analytic_shapes) {
+    if (!shapes.init_instances(backend, kShapeInstance, sizeof(ShapeInstance), options.chunk_size, options.max_chunks))
+      return false;
+    shapes.set_constants(&constants);
+    shapes.set_stats(stats);
+  }
+  return true;
+}
 
-D3DXVECTOR2 ScreenToClip::to_clip(float x, float y)
+void Thud::Canvas::close()
 {
-	// cx=(2*(sx-cex/2))/sex
-	// cy=(2*(sey/2-sy))/sey
-
-	return D3DXVECTOR2(
-		-clip_extents.x / 2 + 2 * x / screen_extents.x,
-		clip_extents.y / 2 - 2  * y / screen_extents.y);
+  verts.close();
+  rects.close();
+  lines.close();
+  shapes.close();
+  cache.close();
 }
 
-D3DXVECTOR2 ScreenToClip::to_screen(float x, float y)
+void Thud::Canvas::begin()
 {
-	// sx=(cx*sex+cex)/2
-	// sy=-((cy-1)*sey)/2
-
-	return D3DXVECTOR2(
-		(x * screen_extents.x + clip_extents.x)/2,
-		-((y - 1) * screen_extents.y)/ 2);
-
+  verts.begin();
+  if (rects.num_chunks()) {
+    rects.begin();
+    lines.begin();
+  }
+  if (shapes.num_chunks())
+    shapes.begin();
 }
 
-// Thud - 2d renderer
-struct Thud
+void Thud::Canvas::end()
 {
-	Thud();
-
-  static Thud& instance();
-
-  bool init();
-  bool close();
-
-  void push_state();
-  void pop_state();
-
-	void add_canvas();
-
-  void set_extents(const D3DXVECTOR2& extents);
-
-  void set_fill(const D3DXCOLOR& col);
-  void set_stroke(const D3DXCOLOR& col);
-
-  void clear(const D3DXCOLOR& col);
-
-  void set_circle_segments(int num_segments);
-  void circle(const D3DXVECTOR3& o, float r);
-  void circle(const D3DXVECTOR3& o, float r, int segments);
-
-  void rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size);
-
-	void line(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, float w);
-
-  void start_frame();
-  void render();
-
-  struct State
-  {
-    State()
-      : circle_segments(40)
-      , fill(D3DXCOLOR(0,0,0,0))
-      , stroke(D3DXCOLOR(1,1,1,1))
-    {
-    }
-    int circle_segments;
-    D3DXCOLOR fill;
-    D3DXCOLOR stroke;
-  };
-
-	struct Canvas
-	{
-		Canvas()
-      : ptr(nullptr)
-		{
-		}
-
-		bool init()
-		{
-			RETURN_ON_FAIL_BOOL_E(verts.create(32 * 1024));
-			return true;
-		}
-
-    void map()
-    {
-      ptr = verts.map();
-    }
+  verts.end();
+  if (rects.num_chunks()) {
+    rects.end();
+    lines.end();
+  }
+  if (shapes.num_chunks())
+    shapes.end();
+}
 
-    int unmap()
-    {
-      const int c = verts.unmap(ptr);
-      ptr = nullptr;
-      return c;
-    }
+void Thud::Canvas::update(const D3DXVECTOR2& pixel_extents, bool transform_in_shader)
+{
+  screen_to_clip.screen_extents = extents;
+  screen_to_clip.pixel_extents = pixel_extents;
+  screen_to_clip.clip_origin = D3DXVECTOR2(0,0);
+  screen_to_clip.clip_extents = D3DXVECTOR2(2, 2);
+  screen_to_clip.update();
+
+  vertex_transform = screen_to_clip;
+  if (transform_in_shader) {
+    vertex_transform.scale = D3DXVECTOR2(1, 1);
+    vertex_transform.bias = D3DXVECTOR2(0, 0);
+  }
 
-    D3DXVECTOR2 scale;
-		D3DXVECTOR2 extents;
-		DynamicVb<PosCol> verts;
-    PosCol *ptr;
-	};
-
-	ScreenToClip _screen_to_clip;
-	EffectWrapper *_effect;
-	CComPtr<ID3D11InputLayout> _layout;
-  CComPtr<ID3D11Buffer> _cbuffer;
-  std::deque<State> _state_stack;
-	std::deque<Canvas> _canvas_stack;
-  static Thud *_instance;
-};
+  // clip = pos * scale + bias, followed by the zoom, which scales clip space
+  const ScreenToClip& s2c = screen_to_clip;
+  constants.scale = D3DXVECTOR4(scale.x, scale.y, 1, 1);
+  constants.bias = D3DXVECTOR4(0, 0, 0, 0);
+  if (transform_in_shader) {
+    constants.scale.x *= s2c.scale.x;
+    constants.scale.y *= s2c.scale.y;
+    constants.bias.x = s2c.bias.x * scale.x;
+    constants.bias.y = s2c.bias.y * scale.y;
+  }
+  constants.screen_to_clip = D3DXVECTOR4(
+    s2c.scale.x * scale.x, s2c.scale.y * scale.y, s2c.bias.x * scale.x, s2c.bias.y * scale.y);
+
+  // the corners of clip space mapped back through the zoom and
+  // screen_to_clip, so zooming out shows more than the extents
+  const D3DXVECTOR2 c0((-1 / scale.x - s2c.bias.x) / s2c.scale.x, (-1 / scale.y - s2c.bias.y) / s2c.scale.y);
+  const D3DXVECTOR2 c1((1 / scale.x - s2c.bias.x) / s2c.scale.x, (1 / scale.y - s2c.bias.y) / s2c.scale.y);
+  visible = Bounds(D3DXVECTOR2(min(c0.x, c1.x), min(c0.y, c1.y)), D3DXVECTOR2(max(c0.x, c1.x), max(c0.y, c1.y)));
+  pixels_per_unit = max(fabsf(scale.x) * pixel_extents.x / extents.x, fabsf(scale.y) * pixel_extents.y / extents.y);
+
+  // the range of packed vertices is the extents, in the space the vertices
+  // are written in, and as much again on every side
+  const D3DXVECTOR2 a = vertex_transform.to_clip(0, 0);
+  const D3DXVECTOR2 b = vertex_transform.to_clip(extents.x, extents.y);
+  constants.packed = D3DXVECTOR4(1.5f * fabsf(b.x - a.x), 1.5f * fabsf(b.y - a.y), (a.x + b.x) / 2, (a.y + b.y) / 2);
+
+  // clip space is 2 wide, and the zoom is in screen_to_clip
+  const D3DXVECTOR4& c = constants.screen_to_clip;
+  constants.pixel_size = D3DXVECTOR4(
+    2 / (fabsf(c.x) * pixel_extents.x), 2 / (fabsf(c.y) * pixel_extents.y), 0, 0);
+}
 
 Thud *Thud::_instance = nullptr;
 
 Thud::Thud()
-	: _effect(nullptr)
+	: _draws_saved(0)
+  , _num_culled(0)
+  , _retained_draws(0)
+  , _backend(nullptr)
+  , _canvas(0)
+  , _capture(nullptr)
+  , _capture_recorder(nullptr)
 {
 
 }
@@ -170,44 +136,88 @@ Thud& Thud::instance()
   return !_instance ? *(_instance = new Thud) : *_instance;
 }
 
-bool Thud::init()
+bool Thud::init(Backend *backend, const Options& options)
 {
-  // default state
-  _state_stack.push_back(State());
-	_canvas_stack.push_back(Canvas());
-	RETURN_ON_FAIL_BOOL_E(_canvas_stack.back().init());
-
-	
-	_effect = new EffectWrapper();
-	RETURN_ON_FAIL_BOOL_E(_effect->load_shaders(shader, sizeof(shader), "vsMain", NULL, "psMain"));
-
-	RETURN_ON_FAIL_BOOL_E(InputDesc().
-		add("SV_POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0).
-		add("COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12).
-		create(_layout, _effect));
+  _options = options;
+  // a chunk must at least hold the smallest rounded rect, 4 segments and
+  // 4 more rim points, which takes 24 list vertices
+  _options.chunk_size = max(24, _options.chunk_size);
+  _options.max_chunks = max(1, _options.max_chunks);
 
-  RETURN_ON_FAIL_BOOL_E(create_cbuffer(Graphics::instance().device(), 1 * sizeof(D3DXVECTOR4), &_cbuffer.p));
+  _backend = backend;
+  if (!_backend->init())
+    return false;
 
-	set_extents(D3DXVECTOR2((float)Graphics::instance().width(), (float)Graphics::instance().height()));
-
-  return true;
+  // default state
+  _state_stack.push_back(State());
+  return add_canvas() == 0;
 }
 
 bool Thud::close()
 {
-	SAFE_DELETE(_effect);
+  for (size_t i = 0; i < _canvases.size(); ++i)
+    _canvases[i].close();
+  for (size_t i = 0; i < _recorders.size(); ++i)
+    delete _recorders[i];
+  _recorders.clear();
+  for (auto it = _retained.begin(); it != _retained.end(); ++it)
+    it->second.close();
+  _retained.clear();
+  delete _capture_recorder;
+
+  if (_backend)
+    _backend->close();
+	SAFE_DELETE(_backend);
 
   delete this;
   _instance = nullptr;
   return true;
 }
 
+int Thud::add_canvas()
+{
+  // the canvas index goes in 8 bits of the draw list keys
+  if (_canvases.size() >= 256)
+    return -1;
+  _canvases.push_back(Canvas());
+  if (!_canvases.back().init(_backend, _options, &_stats)) {
+    _canvases.back().close();
+    _canvases.pop_back();
+    return -1;
+  }
+  _canvas = (int)_canvases.size() - 1;
+  set_extents(_backend->extents());
+  return _canvas;
+}
+
+void Thud::set_canvas(int index)
+{
+  assert(index >= 0 && index < (int)_canvases.size() && !_capture);
+  _canvas = index;
+}
+
 void Thud::set_extents(const D3DXVECTOR2& extents)
 {
-  Canvas& cur = _canvas_stack.back();
-	_screen_to_clip.screen_extents = extents;
-	_screen_to_clip.clip_origin = D3DXVECTOR2(0,0);
-	_screen_to_clip.clip_extents = D3DXVECTOR2(2, 2);
+  Canvas& cur = canvas();
+  cur.extents = extents;
+  cur.update(_backend->extents(), _options.transform_in_shader);
+}
+
+void Thud::set_canvas_scale(const D3DXVECTOR2& scale)
+{
+  Canvas& cur = canvas();
+  cur.scale = scale;
+  cur.update(_backend->extents(), _options.transform_in_shader);
+}
+
+bool Thud::begin_cached_canvas(uint32_t version)
+{
+  return begin_capture(canvas().cache, version);
+}
+
+void Thud::end_cached_canvas()
+{
+  end_capture();
 }
 
 void Thud::set_fill(const D3DXCOLOR& col)
@@ -220,596 +230,650 @@ void Thud::set_stroke(const D3DXCOLOR& col)
   _state_stack.back().stroke = col;
 }
 
-void Thud::clear(const D3DXCOLOR& col)
+void Thud::set_blend(BlendMode mode)
 {
-
+  _state_stack.back().blend = mode;
 }
 
-void Thud::start_frame()
+void Thud::clear(const D3DXCOLOR&)
 {
-  Canvas& canvas = _canvas_stack.back();
-  canvas.map();
-
-  Graphics& graphics = Graphics::instance();
-  ID3D11Device* device = graphics.device();
-  ID3D11DeviceContext* context = graphics.context();
 
-  // set the cbuffer
-  D3DXVECTOR4 *scale = (D3DXVECTOR4 *)map_buffer(context, _cbuffer);
-  scale->x = canvas.scale.x;
-  scale->y = canvas.scale.y;
-	scale->x = scale->y = scale->z = scale->w = 1;
-  unmap_buffer(context, _cbuffer);
-  context->VSSetConstantBuffers(0, 1, &_cbuffer.p);
 }
 
-void Thud::render()
+void Thud::set_scissor(const D3DXVECTOR2& top_left, const D3DXVECTOR2& size)
 {
-  Graphics& graphics = Graphics::instance();
-  ID3D11Device* device = graphics.device();
-  ID3D11DeviceContext* context = graphics.context();
-
-  Canvas& canvas = _canvas_stack.back();
-  const int num_verts = canvas.unmap();
-
-  context->OMSetDepthStencilState(graphics.default_dss(), graphics.default_stencil_ref());
-  context->OMSetBlendState(graphics.default_blend_state(), graphics.default_blend_factors(), graphics.default_sample_mask());
+  State& state = _state_stack.back();
+  state.scissor = true;
+  state.scissor_bounds = Bounds::corners(
+    D3DXVECTOR3(top_left.x, top_left.y, 0),
+    D3DXVECTOR3(top_left.x + size.x, top_left.y + size.y, 0));
+}
 
-  _effect->set_shaders(context);
-  context->IASetInputLayout(_layout);
-  set_vb(context, canvas.verts.get(), canvas.verts.stride);
-  context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-  context->Draw(num_verts, 0);
+void Thud::clear_scissor()
+{
+  _state_stack.back().scissor = false;
 }
 
-void Thud::circle(const D3DXVECTOR3& o, float r)
+Bounds Thud::cull_bounds() const
 {
-  const State& state = _state_stack.back();
-  Canvas& canvas = _canvas_stack.back();
-  PosCol*& ptr = canvas.ptr;
-  const float inc = 2 * (float)kPi / (state.circle_segments);
-  float ofs = 0;
-  D3DXVECTOR3 cur = D3DXVECTOR3(o.x + r * cosf(ofs), o.y + r * sinf(ofs), o.z);
-  for (int i = 0; i < state.circle_segments; ++i) {
-    D3DXVECTOR3 next = D3DXVECTOR3(o.x + r * cosf(ofs + inc), o.y + r * sinf(ofs + inc), o.z);
-    *ptr++ = PosCol(_screen_to_clip.to_clip(o.x, o.y), o.z, state.fill);
-    *ptr++ = PosCol(_screen_to_clip.to_clip(cur.x, cur.y), cur.z, state.fill);
-		*ptr++ = PosCol(_screen_to_clip.to_clip(next.x, next.y), next.z, state.fill);
-    cur = next;
-    ofs += inc;
+  // captured geometry is drawn again at other zooms without being redrawn,
+  // so it keeps everything within the extents as well
+  Bounds visible = canvas().visible;
+  if (_capture) {
+    visible.add(D3DXVECTOR3(0, 0, 0));
+    visible.add(D3DXVECTOR3(canvas().extents.x, canvas().extents.y, 0));
   }
+  const State& state = _state_stack.back();
+  return state.scissor ? visible.intersect(state.scissor_bounds) : visible;
 }
 
-void Thud::rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size)
+bool Thud::cull(const Bounds& b)
 {
-	const State& state = _state_stack.back();
-	Canvas& canvas = _canvas_stack.back();
-	PosCol*& ptr = canvas.ptr;
-
-	// v0, v1
-	// v2, v3
-	const D3DXVECTOR3 v0 = top_left;
-	const D3DXVECTOR3 v1 = top_left + D3DXVECTOR3(size.x, 0, 0);
-	const D3DXVECTOR3 v2 = top_left + D3DXVECTOR3(0, size.y, 0);
-	const D3DXVECTOR3 v3 = top_left + D3DXVECTOR3(size.x, size.y, 0);
-
-	// v0, v1, v2
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v0.x, v0.y), v0.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v1.x, v1.y), v1.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v2.x, v2.y), v2.z, state.fill);
-
-	// v2, v1, v3
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v2.x, v2.y), v2.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v1.x, v1.y), v1.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v3.x, v3.y), v3.z, state.fill);
+  if (b.overlaps(cull_bounds()))
+    return false;
+  ++_num_culled;
+  return true;
 }
 
-void Thud::line(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, float w)
+void Thud::set_circle_segments(int num_segments)
 {
-	const D3DXVECTOR3 n0 = vec3_normalize(D3DXVECTOR3(p0.y - p1.y, p1.x - p0.x, 0));
-	const D3DXVECTOR3 n1 = vec3_normalize(D3DXVECTOR3(p1.y - p0.y, p0.x - p1.x, 0));
-
-	// v0, v1
-	// v2, v3
-	const D3DXVECTOR3 v0 = p0 + 0.5f * w * n0;
-	const D3DXVECTOR3 v1 = p1 + 0.5f * w * n0;
-	const D3DXVECTOR3 v2 = p0 + 0.5f * w * n1;
-	const D3DXVECTOR3 v3 = p1 + 0.5f * w * n1;
-
-	const State& state = _state_stack.back();
-	Canvas& canvas = _canvas_stack.back();
-	PosCol*& ptr = canvas.ptr;
-
-	// v0, v1, v2
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v0.x, v0.y), v0.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v2.x, v2.y), v2.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v1.x, v1.y), v1.z, state.fill);
-
-	// v2, v1, v3
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v2.x, v2.y), v2.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v3.x, v3.y), v3.z, state.fill);
-	*ptr++ = PosCol(_screen_to_clip.to_clip(v1.x, v1.y), v1.z, state.fill);
-
+  _state_stack.back().circle_segments = num_segments;
 }
 
-void Thud::push_state()
+void Thud::set_circle_tolerance(float max_error_px)
 {
-  _state_stack.push_back(State());
+  _state_stack.back().circle_tolerance = max(0.0f, max_error_px);
 }
 
-void Thud::pop_state()
+int Thud::max_circle_segments() const
 {
-  _state_stack.pop_back();   
+  // an indexed circle uses segments+1 vertices and 3*segments indices
+  return _options.indexed ? _options.chunk_size - 1 : _options.chunk_size / 3;
 }
 
-LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+void Thud::start_frame()
 {
-  if( TwEventWin(hWnd, message, wParam, lParam) ) // send event message to AntTweakBar
-    return 0;
+  _stats.reset();
+  THUD_TIME(_stats.start_frame_ns);
+  THUD_TRACE("Thud::start_frame");
+  for (size_t i = 0; i < _canvases.size(); ++i)
+    _canvases[i].begin();
+  _draw_list.clear();
+  _num_culled = 0;
+  _retained_frame.clear();
+  _backend->start_frame(_canvases[0].constants);
+}
 
-  switch(message)
-  {
+void Thud::render()
+{
+  THUD_TIME(_stats.render_ns);
+  THUD_TRACE("Thud::render");
+  _draws_saved = 0;
+  if (_options.deferred) {
+    THUD_TRACE("Thud::render deferred");
+    _draw_list.sort();
+    _draws_saved = _draw_list.count_draws(false) - _draw_list.count_draws(true);
+    for (int i = 0; i < _draw_list.size(); ++i)
+      emit(_draw_list[i]);
+    _draw_list.clear();
+  }
 
-  case WM_KEYUP:
-    switch (wParam)
-    {
-    case VK_ESCAPE:
-      PostQuitMessage(0);
-      break;
+  // each canvas, followed by the groups used in it
+  _retained_draws = 0;
+  for (int c = 0; c < (int)_canvases.size(); ++c) {
+    Canvas& canvas = _canvases[c];
+    canvas.end();
+    bool first = true;
+    for (size_t i = 0; i < _retained_frame.size(); ++i) {
+      if (_retained_frame[i]->canvas != c)
+        continue;
+      if (first)
+        _backend->set_constants(canvas.constants);
+      first = false;
+      draw_retained(*_retained_frame[i]);
     }
-    break;
-  case WM_DESTROY:
-    PostQuitMessage(0);
-    break;
-  default:
-    return DefWindowProc(hWnd, message, wParam, lParam);
   }
-
-  return 0;
 }
 
-D3DXVECTOR3 bezier(float t, const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, const D3DXVECTOR3& p2, const D3DXVECTOR3& p3)
+void Thud::begin_recorder(Recorder& recorder)
 {
-	const float tt = (1-t);
-	const float tt2 = tt*tt;
-	const float tt3 = tt2*tt;
-
-	const float t2 = t*t;
-	const float t3 = t2*t;
-
-	return tt3 * p0 + 3 * tt2 * t * p1 + 3 * tt * t2 * p2 + t3 * p3;
+  const Canvas& cur = canvas();
+  recorder.begin(cur.vertex_transform, cur.pixels_per_unit, cur.visible, _options.indexed, max_circle_segments());
 }
 
-void console_printf(const char *fmt, ...)
+void Thud::merge(const Recorder& recorder)
 {
-  va_list arg;
-  va_start(arg, fmt);
+  Canvas& canvas = this->canvas();
+  const std::vector<Recorder::Primitive>& prims = recorder.primitives();
+  const size_t n = prims.size();
+  THUD_COUNT(&_stats, recorded, (int)n);
+  _num_culled += recorder.num_culled();
+
+  size_t i = 0;
+  while (i < n) {
+    // take as many primitives as fit in what's left of the current chunk,
+    // and at least one, which moves to the next chunk if it has to
+    const Recorder::Primitive& first = prims[i];
+    const int space = canvas.verts.available();
+    const int index_space = canvas.verts.available_indices();
+    int num_verts = first.num_verts;
+    int num_indices = first.num_indices;
+    size_t j = i + 1;
+    for (; j < n && prims[j].blend == first.blend; ++j) {
+      if (num_verts + prims[j].num_verts > space || num_indices + prims[j].num_indices > index_space)
+        break;
+      num_verts += prims[j].num_verts;
+      num_indices += prims[j].num_indices;
+    }
 
-  const int len = _vscprintf(fmt, arg) + 1;
-  char* buf = (char*)_alloca(len);
-  vsprintf_s(buf, len, fmt, arg);
-  OutputDebugStringA(buf);
+    // the primitives are contiguous in the recorder
+    canvas.verts.set_blend(first.blend);
+    const PosCol *src = &recorder.verts()[first.first_vertex];
+    if (canvas.indexed()) {
+      void *idx;
+      int base;
+      PosCol *dst = canvas.alloc_indexed(num_verts, num_indices, &idx, &base);
+      memcpy(dst, src, num_verts * sizeof(PosCol));
+      IndexWriter indices(idx, canvas.index_stride(), base - first.first_vertex);
+      const uint32_t *src_indices = &recorder.indices()[first.first_index];
+      for (int k = 0; k < num_indices; ++k)
+        indices(src_indices[k]);
+    } else {
+      memcpy(canvas.alloc(num_verts), src, num_verts * sizeof(PosCol));
+    }
+    i = j;
+  }
 }
 
-
-template<typename T>
-struct Matrix2d
+void Thud::record(TaskPool& pool, int n, const std::function<void (int, Recorder&)>& fn)
 {
-  Matrix2d()
-    : _data(NULL)
-    , _rows(0)
-    , _cols(0)
-  {
-  }
-
-  Matrix2d(int rows, int cols) 
-    : _rows(rows)
-    , _cols(cols) 
-  {
-    _data = new T[rows * cols];
+  while ((int)_recorders.size() < n)
+    _recorders.push_back(new Recorder());
+
+  for (int i = 0; i < n; ++i) {
+    Recorder *recorder = _recorders[i];
+    begin_recorder(*recorder);
+    pool.push([i, recorder, &fn] {
+      THUD_TRACE("Thud::record task");
+      fn(i, *recorder);
+    });
   }
+  pool.wait();
 
-  void init(int rows, int cols)
-  {
-    reset();
-    _rows = rows;
-    _cols = cols;
-    _data = new T[rows*cols];
-  }
-
-  ~Matrix2d()
-  {
-    reset();
-  }
-
-  Matrix2d(const Matrix2d& rhs)
-    : _data(NULL)
-    , _rows(0)
-    , _cols(0)
-  {
-    if (&rhs == this)
-      return;
+  THUD_TRACE("Thud::record merge");
+  for (int i = 0; i < n; ++i)
+    merge(*_recorders[i]);
+}
 
-    assign(rhs);
+int Thud::num_draws() const
+{
+  int draws = 0;
+  for (size_t i = 0; i < _canvases.size(); ++i) {
+    const Canvas& canvas = _canvases[i];
+    draws += canvas.verts.num_draws() + canvas.rects.num_draws() + canvas.lines.num_draws() + canvas.shapes.num_draws();
   }
+  return draws + _retained_draws;
+}
 
-  Matrix2d& operator=(const Matrix2d& rhs)
-  {
-    reset();
-    assign(rhs);
-  }
+void Thud::Retained::close()
+{
+  SAFE_DELETE(verts);
+  SAFE_DELETE(indices);
+  runs.clear();
+}
 
-  const T& at(int row, int col) const
-  {
-    return _data[row*_cols+col];
-  }
+bool Thud::begin_retained(uint32_t key, uint32_t version)
+{
+  return begin_capture(_retained[key], version);
+}
 
-  T& at(int row, int col)
-  {
-    return _data[row*_cols+col];
-  }
+void Thud::end_retained()
+{
+  end_capture();
+}
 
-  const T& operator()(int row, int col) const
-  {
-    return _data[row*_cols+col];
-  }
+bool Thud::begin_capture(Retained& group, uint32_t version)
+{
+  assert(!_capture);
+  group.canvas = _canvas;
+  _retained_frame.push_back(&group);
+  // a new group has no buffers yet
+  if (group.verts && group.version == version)
+    return false;
+
+  group.version = version;
+  _capture = &group;
+  if (!_capture_recorder)
+    _capture_recorder = new Recorder();
+  begin_recorder(*_capture_recorder);
+  return true;
+}
 
-  T& operator()(int row, int col)
-  {
-    return _data[row*_cols+col];
+void Thud::end_capture()
+{
+  assert(_capture);
+  Retained& group = *_capture;
+  const Recorder& recorder = *_capture_recorder;
+  _capture = nullptr;
+
+  // grow the sinks in powers of two, so a group that changes size a
+  // little doesn't get new buffers every time
+  const int num_verts = (int)recorder.verts().size();
+  const int num_indices = (int)recorder.indices().size();
+  if (!group.verts || group.verts->capacity() < num_verts) {
+    int capacity = 256;
+    while (capacity < num_verts)
+      capacity *= 2;
+    SAFE_DELETE(group.verts);
+    group.verts = _backend->create_static_vertex_sink(sizeof(PosCol), capacity);
   }
-
-  void reset()
-  {
-    delete [] _data;
-    _data = NULL;
-    _rows = _cols = 0;
+  if (num_indices && (!group.indices || group.indices->capacity() < num_indices)) {
+    int capacity = 256;
+    while (capacity < num_indices)
+      capacity *= 2;
+    SAFE_DELETE(group.indices);
+    group.indices = _backend->create_static_index_sink(4, capacity);
   }
-
-  void assign(const Matrix2d& rhs)
-  {
-    _rows = rhs._rows;
-    _cols = rhs._cols;
-    _data = new T[_rows * _cols];
+  if (!group.verts || (num_indices && !group.indices)) {
+    // out of memory, try again next frame
+    group.close();
+    return;
   }
 
-  int rows() const { return _rows; }
-  int cols() const { return _cols; }
-
-  void augment(const Matrix2d& a, Matrix2d *out)
-  {
-    // out = [this|a];
-    out->init(rows(), cols() + a.cols());
-
-    const int nr = out->rows();
-    const int nc = out->cols();
-
-    for (int i = 0; i < out->rows(); ++i) {
-      memcpy(&out->_data[i*nc], &_data[i*cols()], cols()*sizeof(T));
-      memcpy(&out->_data[i*nc+cols()], &a._data[i*a.cols()], a.cols()*sizeof(T));
+  _backend->update(group.verts, 0, recorder.verts().data(), num_verts);
+  if (num_indices)
+    _backend->update(group.indices, 0, recorder.indices().data(), num_indices);
+  THUD_COUNT(&_stats, bytes_uploaded, num_verts * sizeof(PosCol) + num_indices * 4);
+
+  group.runs.clear();
+  const std::vector<Recorder::Primitive>& prims = recorder.primitives();
+  for (size_t i = 0; i < prims.size(); ++i) {
+    const Recorder::Primitive& prim = prims[i];
+    const int count = num_indices ? prim.num_indices : prim.num_verts;
+    if (!group.runs.empty() && group.runs.back().blend == prim.blend) {
+      group.runs.back().count += count;
+    } else {
+      Retained::Run run = { num_indices ? prim.first_index : prim.first_vertex, count, prim.blend };
+      group.runs.push_back(run);
     }
   }
+}
 
-  void console_print()
-  {
-    for (int i = 0; i < rows(); ++i) {
-      for (int j = 0; j < cols(); ++j) {
-        console_printf("%8f ", at(i,j));
-      }
-      console_printf("\n");
-    }
-    console_printf("\n");
-  }
+void Thud::release_retained(uint32_t key)
+{
+  auto it = _retained.find(key);
+  if (it == _retained.end())
+    return;
+  _retained_frame.erase(remove(_retained_frame.begin(), _retained_frame.end(), &it->second), _retained_frame.end());
+  it->second.close();
+  _retained.erase(it);
+}
 
-  void print()
-  {
-    for (int i = 0; i < rows(); ++i) {
-      for (int j = 0; j < cols(); ++j) {
-        printf("%8f ", at(i,j));
-      }
-      printf("\n");
-    }
-    printf("\n");
+void Thud::draw_retained(const Retained& group)
+{
+  for (size_t i = 0; i < group.runs.size(); ++i) {
+    const Retained::Run& run = group.runs[i];
+    _backend->set_blend(run.blend);
+    if (_options.indexed)
+      _backend->draw_indexed(group.verts, group.indices, run.first, run.count, 0);
+    else
+      _backend->draw(group.verts, run.first, run.count);
+    ++_retained_draws;
+    THUD_COUNT(&_stats, draw_calls, 1);
   }
+}
 
-  T* _data;
-  int _rows;
-  int _cols;
-};
-
-
-template<typename T>
-void augment(const Matrix2d<T>& a, const Matrix2d<T>& b, Matrix2d<T> *out)
+void Thud::capture(const DrawCommand& cmd)
 {
-  // out = [a|b];
-  out->init(a.rows(), a.cols() + b.cols());
-
-  const int nr = out->rows();
-  const int nc = out->cols();
-
-  for (int i = 0; i < out->rows(); ++i) {
-    memcpy(&out->_data[i*nc], &a._data[i*a.cols()], a.cols()*sizeof(T));
-    memcpy(&out->_data[i*nc+a.cols()], &b._data[i*b.cols()], b.cols()*sizeof(T));
+  // the same tessellation as emit, into the recorder instead of the canvas.
+  // Rects, lines and shapes are always triangles here, as the instance
+  // arenas are per frame
+  THUD_TIME(_stats.tessellate_ns);
+  Recorder& out = *_capture_recorder;
+  const ScreenToClip& xform = canvas().vertex_transform;
+  out.set_blend((BlendMode)cmd.blend);
+  switch (cmd.kind) {
+    case kCircleCommand:
+      tessellate_circle(out, xform, _circle_tables.get(cmd.segments), cmd.p0, cmd.w, cmd.segments, cmd.col);
+      break;
+    case kRectCommand:
+      tessellate_rect(out, xform, cmd.p0, cmd.p1, cmd.col);
+      break;
+    case kLineCommand:
+      tessellate_line(out, xform, cmd.p0, cmd.p1, cmd.w, cmd.col);
+      break;
+    case kPolylineCommand:
+      tessellate_polyline(out, xform, _draw_list.points(cmd.first), cmd.segments,
+        0, cmd.segments - 1, cmd.w, (LineJoin)cmd.join, cmd.col);
+      break;
+    case kEllipseCommand:
+      tessellate_ellipse(out, xform, _circle_tables.get(cmd.segments), cmd.p0,
+        D3DXVECTOR2(cmd.p1.x, cmd.p1.y), cmd.segments, cmd.col);
+      break;
+    case kRoundedRectCommand:
+      tessellate_rounded_rect(out, xform, _circle_tables.get(cmd.segments), cmd.p0,
+        D3DXVECTOR2(cmd.p1.x, cmd.p1.y), cmd.w, cmd.segments, cmd.col);
+      break;
   }
 }
 
-
-template<typename T>
-void gaussian_solve(Matrix2d<T>& c, Matrix2d<T> *x)
+int Thud::adaptive_circle_segments(float r, float max_error_px) const
 {
-  // solve m*x = a via gaussian elimination
-  // c is the augmented matrix, [m|a]
-
-  x->init(c.rows(), 1);
+  const float r_px = r * canvas().pixels_per_unit;
+  return min(circle_segments_for_error(r_px, max_error_px), max_circle_segments());
+}
 
-  // TODO: do pivoting
+int Thud::state_circle_segments(float r) const
+{
+  const State& state = _state_stack.back();
+  return state.circle_tolerance > 0
+    ? adaptive_circle_segments(r, state.circle_tolerance)
+    : state.circle_segments;
+}
 
-  T eps = 0.00001f;
+void Thud::circle(const D3DXVECTOR3& o, float r)
+{
+  circle(o, r, state_circle_segments(r));
+}
 
-  // row reduction
-  for (int i = 0; i < c.rows(); ++i) {
-    const T v = c.at(i,i);
-    // skip if we already have a leading 1
-    if ((T)abs(1-v) < eps)
-      continue;
+void Thud::circle(const D3DXVECTOR3& o, float r, int segments)
+{
+  // there's no table for no segments, and nothing to draw
+  if (segments < 1)
+    return;
+  if (cull(Bounds::corners(o, o).expand(r)))
+    return;
+
+  DrawCommand cmd;
+  cmd.kind = kCircleCommand;
+  cmd.pipeline = _options.analytic_shapes ? kShapePipeline : kTrianglePipeline;
+  cmd.segments = min(segments, max_circle_segments());
+  cmd.p0 = o;
+  cmd.w = r;
+  submit(cmd);
+}
 
-    const T d = 1 / v;
-    // make the leading element in the current row 1
-    for (int j = i; j < c.cols(); ++j)
-      c.at(i,j) = c.at(i,j) * d;
+void Thud::ellipse(const D3DXVECTOR3& o, const D3DXVECTOR2& radii)
+{
+  const D3DXVECTOR3 r(fabsf(radii.x), fabsf(radii.y), 0);
+  if (cull(Bounds::corners(o - r, o + r)))
+    return;
+
+  const int segments = state_circle_segments(max(r.x, r.y));
+  if (segments < 1)
+    return;
+
+  DrawCommand cmd;
+  cmd.kind = kEllipseCommand;
+  cmd.pipeline = _options.analytic_shapes ? kShapePipeline : kTrianglePipeline;
+  cmd.segments = min(segments, max_circle_segments());
+  cmd.p0 = o;
+  cmd.p1 = r;
+  cmd.w = -1;
+  submit(cmd);
+}
 
-    // reduce the remaining rows to set 0s in the i:th column
-    for (int j = i+1; j < c.rows(); ++j) {
-      const T v = c.at(j,i);
-      // skip if the element is 0 already
-      if ((T)abs(v) < eps)
-        continue;
-      const T d = c.at(j,i) / c.at(i,i);
-      for (int k = i; k < c.cols(); ++k)
-        c.at(j,k) = c.at(j,k) - d * c.at(i,k);
-    }
+void Thud::rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size)
+{
+  const Bounds b = Bounds::corners(top_left, top_left + size);
+  const Bounds visible = cull_bounds();
+  if (!b.overlaps(visible)) {
+    ++_num_culled;
+    return;
   }
 
-  // backward substitution
-  for (int i = 0; i < c.rows() - 1; ++i) {
-    const int cur_row = c.rows() - 2 - i;
-    const int start_col = cur_row + 1;
-    for (int j = 0; j <= i; ++j) {
-      const T s = c.at(cur_row, start_col+j);
-      const T v = c.at(start_col+j, c.cols()-1);
-      c.at(cur_row, c.cols()-1) = c.at(cur_row, c.cols()-1) - s * v;
-      c.at(cur_row, start_col+j) = 0;
-    }
+  DrawCommand cmd;
+  cmd.kind = kRectCommand;
+  cmd.pipeline = _options.instanced ? kRectPipeline : kTrianglePipeline;
+  cmd.segments = 0;
+  cmd.p0 = top_left;
+  cmd.p1 = size;
+  cmd.w = 0;
+  if (!visible.contains(b)) {
+    const Bounds clipped = b.intersect(visible);
+    cmd.p0 = D3DXVECTOR3(clipped.lo.x, clipped.lo.y, top_left.z);
+    cmd.p1 = D3DXVECTOR3(clipped.hi.x - clipped.lo.x, clipped.hi.y - clipped.lo.y, size.z);
   }
-
-  // copy the solution
-  for (int i = 0; i < c.rows(); ++i)
-    x->at(i,0) = c.at(i,c.cols()-1);
+  submit(cmd);
 }
 
-template<typename T>
-void gaussian_solve(const Matrix2d<T>& m, const Matrix2d<T>& a, Matrix2d<T> *x)
+void Thud::rounded_rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size, float corner)
 {
-  // solve m*x = a via gaussian elimination
-  assert(m.rows() == a.rows());
-  assert(m.rows() == m.cols());
+  if (cull(Bounds::corners(top_left, top_left + size)))
+    return;
+
+  // kept as the centre and radii, which is what both the shape and the
+  // tessellation want
+  const D3DXVECTOR3 r(0.5f * fabsf(size.x), 0.5f * fabsf(size.y), 0);
+  DrawCommand cmd;
+  cmd.kind = kRoundedRectCommand;
+  cmd.pipeline = _options.analytic_shapes ? kShapePipeline : kTrianglePipeline;
+  cmd.p0 = D3DXVECTOR3(top_left.x + 0.5f * size.x, top_left.y + 0.5f * size.y, top_left.z);
+  cmd.p1 = r;
+  cmd.w = max(0.0f, min(corner, min(r.x, r.y)));
+  // a quarter of the circle's segments per corner, and room for the 4
+  // extra rim points in a chunk. init keeps the chunks big enough for 4
+  const int most = (max_circle_segments() - 4) & ~3;
+  assert(most >= 4);
+  cmd.segments = max(4, min((state_circle_segments(cmd.w) + 3) & ~3, most));
+  submit(cmd);
+}
 
-  // TODO: do pivoting
+void Thud::line(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, float w)
+{
+  // clip the centre line to the visible area grown by half the width, so
+  // the ends stay just outside it
+  const Bounds visible = cull_bounds().expand(0.5f * w);
+  DrawCommand cmd;
+  cmd.p0 = p0;
+  cmd.p1 = p1;
+  if (!visible.contains(Bounds::corners(p0, p1)) && !clip_segment(visible, &cmd.p0, &cmd.p1)) {
+    ++_num_culled;
+    return;
+  }
 
-  // c = [m|a]
-  Matrix2d<T> c;
-  augment(m, a, &c);
-  gaussian_solve(c, &x);
+  cmd.kind = kLineCommand;
+  cmd.pipeline = _options.instanced ? kLinePipeline : kTrianglePipeline;
+  cmd.segments = 0;
+  cmd.w = w;
+  submit(cmd);
 }
 
-// wrapper around a <data,size> tuple
-template<typename T>
-class AsArray
+void Thud::set_line_join(LineJoin join)
 {
-public:
-  AsArray(T* data, int n) : _data(data), _n(n) {}
-  int size() const { return _n; }
-  T *data() { return _data; }
-private:
-  T *_data;
-  int _n;
-};
+  _state_stack.back().line_join = join;
+}
 
-struct Bezier
+int Thud::max_polyline_points() const
 {
-  static Bezier from_points(AsArray<D3DXVECTOR3> points)
-  {
-    assert(points.size() >= 4);
-
-    // Create a Bezier curve that passes through all the
-    // given points.
-
-    // Create a B-spline, and determine the control points
-    // that pass throught the given points
-
-    Matrix2d<float> m;
-    const int size = points.size() - 2;
-    m.init(size, size+1);
-
-    D3DXVECTOR3 *pts = (D3DXVECTOR3 *)_alloca(sizeof(D3DXVECTOR3) * points.size());
-    D3DXVECTOR3 *d = points.data();
-    pts[0] = d[0];
-    pts[points.size()-1] = d[points.size()-1];
-
-    // solve for each coordinate
-    for (int c = 0; c < 3; ++c) {
-
-      // build the 1-4-1 matrix
-      for (int i = 0; i < size; ++i) {
-        for (int j = 0; j < size; ++j) {
-          m.at(i,j) = 
-            (j == i - 1 || j == i + 1) ? 1.0f :
-            j == i ? 4.0f :
-            0.0f;
-        }
-      }
-
-      // add the control points to the last column
-      for (int i = 0; i < size; ++i)
-        m.at(i, size) = 
-        i == 0 ? (6*d[1][c] - d[0][c]) :
-        i == size - 1 ? (6*d[size][c] - d[size+1][c]) :
-        6 * d[i+1][c];
-
-      // solve..
-      Matrix2d<float> x;
-      gaussian_solve(m, &x);
-
-      // TODO: fix
-      for (int i = 0; i < size; ++i)
-        pts[i+1][c] = x.at(i,0);
-
-    }
+  // a bevelled polyline of n points takes fewer than 3n vertices and 9n
+  // indices, and as many list vertices as indices
+  return max(2, _options.indexed ? _options.chunk_size / 3 : _options.chunk_size / 9);
+}
 
-    Bezier b;
+void Thud::polyline(const D3DXVECTOR3 *pts, int n, float w)
+{
+  if (n < 2)
+    return;
+  // a mitred join can reach kMiterLimit half widths from its point
+  Bounds b = Bounds::corners(pts[0], pts[0]);
+  for (int i = 1; i < n; ++i)
+    b.add(pts[i]);
+  if (cull(b.expand(0.5f * kMiterLimit * w)))
+    return;
+
+  DrawCommand cmd;
+  cmd.kind = kPolylineCommand;
+  cmd.pipeline = kTrianglePipeline;
+  cmd.join = (uint8_t)_state_stack.back().line_join;
+  cmd.segments = n;
+  cmd.first = _draw_list.add_points(pts, n);
+  cmd.p0 = pts[0];
+  cmd.p1 = pts[n - 1];
+  cmd.w = w;
+  submit(cmd);
+  // in immediate mode the points are written by now
+  if (!_options.deferred)
+    _draw_list.clear();
+}
 
-    // there are points-1 bezier curves
-    for (int i = 0; i < points.size()-1; ++i)
-      b.curves.push_back(ControlPoints(
-      d[i+0],
-      2*pts[i+0]/3 + 1*pts[i+1]/3,
-      1*pts[i+0]/3 + 2*pts[i+1]/3,
-      d[i+1]));
+void Thud::set_curve_tolerance(float max_error_px)
+{
+  _state_stack.back().curve_tolerance = max_error_px;
+}
 
-    return b;
+void Thud::bezier(const Bezier& curve, float w)
+{
+  // the curve lies within the hull of its control points, so an offscreen
+  // curve is dropped before it's flattened
+  Bounds b = Bounds::corners(curve.curves[0].p0, curve.curves[0].p0);
+  for (size_t i = 0; i < curve.curves.size(); ++i) {
+    const Bezier::ControlPoints& c = curve.curves[i];
+    b.add(c.p1);
+    b.add(c.p2);
+    b.add(c.p3);
   }
+  if (cull(b.expand(0.5f * kMiterLimit * w)))
+    return;
+
+  // the tolerance is in pixels, and the curve in screen units
+  const float tolerance = _state_stack.back().curve_tolerance / canvas().pixels_per_unit;
+  _polyline.clear();
+  curve.flatten(tolerance, &_polyline);
+  polyline(&_polyline[0], (int)_polyline.size(), w);
+}
 
-  D3DXVECTOR3 interpolate(float t)
-  {
-    int ofs = max(0, min((int)curves.size()-1,(int)t));
-    t = max(0, min(1,t - ofs));
-
-    const ControlPoints& pts = curves[ofs];
-
-    const float tt = (1-t);
-    const float tt2 = tt*tt;
-    const float tt3 = tt2*tt;
-
-    const float t2 = t*t;
-    const float t3 = t2*t;
-
-    return tt3 * pts.p0 + 3 * tt2 * t * pts.p1 + 3 * tt * t2 * pts.p2 + t3 * pts.p3;
+void Thud::submit(DrawCommand& cmd)
+{
+  const State& state = _state_stack.back();
+  cmd.blend = (uint8_t)state.blend;
+  cmd.canvas = (uint8_t)_canvas;
+  cmd.col = state.fill;
+  THUD_COUNT(&_stats, primitives[cmd.kind], 1);
+
+  if (_capture)
+    capture(cmd);
+  else if (_options.deferred)
+    _draw_list.add(cmd);
+  else
+    emit(cmd);
+}
 
+void Thud::emit(const DrawCommand& cmd)
+{
+  THUD_TIME(_stats.tessellate_ns);
+  Canvas& canvas = _canvases[cmd.canvas];
+  const BlendMode blend = (BlendMode)cmd.blend;
+  switch (cmd.pipeline) {
+    case kTrianglePipeline: canvas.verts.set_blend(blend); break;
+    case kRectPipeline: canvas.rects.set_blend(blend); break;
+    case kLinePipeline: canvas.lines.set_blend(blend); break;
+    case kShapePipeline: canvas.shapes.set_blend(blend); break;
   }
 
+  switch (cmd.kind) {
+    case kCircleCommand: emit_circle(canvas, cmd); break;
+    case kRectCommand: emit_rect(canvas, cmd); break;
+    case kLineCommand: emit_line(canvas, cmd); break;
+    case kPolylineCommand: emit_polyline(canvas, cmd); break;
+    case kEllipseCommand: emit_ellipse(canvas, cmd); break;
+    case kRoundedRectCommand: emit_rounded_rect(canvas, cmd); break;
+  }
+}
 
-  struct ControlPoints
-  {
-    ControlPoints(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, const D3DXVECTOR3& p2, const D3DXVECTOR3& p3) : p0(p0), p1(p1), p2(p2), p3(p3) {}
-    D3DXVECTOR3 p0, p1, p2, p3;
-  };
-
-  std::vector<ControlPoints> curves;
-
-
-};
-
-
-
-int WINAPI WinMain( __in HINSTANCE hInstance, __in_opt HINSTANCE hPrevInstance, __in LPSTR lpCmdLine, __in int nShowCmd )
+void Thud::emit_circle(Canvas& canvas, const DrawCommand& cmd)
 {
+  if (cmd.pipeline == kShapePipeline) {
+    emit_shape(canvas, cmd, D3DXVECTOR2(fabsf(cmd.w), fabsf(cmd.w)), -1);
+    return;
+  }
+  const D3DXVECTOR2 *dir = _circle_tables.get(cmd.segments);
+  tessellate_circle(canvas, canvas.vertex_transform, dir, cmd.p0, cmd.w, cmd.segments, cmd.col);
+}
 
-  static TCHAR window_class[] = _T("Thud Main Window");
-  const int width = GetSystemMetrics(SM_CXSCREEN) / 2;
-  const int height = GetSystemMetrics(SM_CYSCREEN) / 2;
-	const float apsect = (float)width / height;
-
-  WNDCLASSEX wcex;
-  ZeroMemory(&wcex, sizeof(wcex));
-  wcex.cbSize = sizeof(wcex);
-  wcex.style = CS_HREDRAW | CS_VREDRAW;
-  wcex.lpfnWndProc = WndProc;
-  wcex.hInstance = hInstance;
-  wcex.lpszClassName = window_class;
-
-  if (!RegisterClassEx(&wcex))
-    return 1;
-
-  const DWORD style = WS_OVERLAPPEDWINDOW;
-  RECT r;
-  r.top = 0;
-  r.left = 0;
-  r.bottom = height;
-  r.right = width;
-  AdjustWindowRect(&r, style, TRUE);
-  int w = r.right - r.left;
-  int h = r.bottom - r.top;
-
-  HWND hwnd = CreateWindow(window_class, window_class, style, CW_USEDEFAULT, CW_USEDEFAULT, w, h, NULL, NULL, hInstance, NULL);
-  if (!hwnd)
-    return 1;
-
-  ShowWindow(hwnd, nShowCmd);
-  UpdateWindow(hwnd);
-
-  Graphics& graphics = Graphics::instance();
-  Thud& thud = Thud::instance();
-
-
-  if (!graphics.init_directx(hwnd, width, height))
-    return 1;
-
-  if (!thud.init())
-    return 1;
-
-  MSG msg;
-  ZeroMemory(&msg, sizeof(msg));
-
-  D3DXVECTOR3 pts[] = 
-  {
-    D3DXVECTOR3(0, 0, 0),
-    D3DXVECTOR3(160, 100, 0),
-    D3DXVECTOR3(500, 200, 0),
-    D3DXVECTOR3(200, 500, 0),
-    D3DXVECTOR3((float)width, (float)height, 0),
-  };
+void Thud::emit_ellipse(Canvas& canvas, const DrawCommand& cmd)
+{
+  const D3DXVECTOR2 radii(cmd.p1.x, cmd.p1.y);
+  if (cmd.pipeline == kShapePipeline) {
+    emit_shape(canvas, cmd, radii, -1);
+    return;
+  }
+  const D3DXVECTOR2 *dir = _circle_tables.get(cmd.segments);
+  tessellate_ellipse(canvas, canvas.vertex_transform, dir, cmd.p0, radii, cmd.segments, cmd.col);
+}
 
-  const int num = ELEMS_IN_ARRAY(pts);
+void Thud::emit_rounded_rect(Canvas& canvas, const DrawCommand& cmd)
+{
+  const D3DXVECTOR2 radii(cmd.p1.x, cmd.p1.y);
+  if (cmd.pipeline == kShapePipeline) {
+    emit_shape(canvas, cmd, radii, cmd.w);
+    return;
+  }
+  if (cmd.w <= 0) {
+    const D3DXVECTOR3 size(2 * radii.x, 2 * radii.y, 0);
+    tessellate_rect(canvas, canvas.vertex_transform, cmd.p0 - 0.5f * size, size, cmd.col);
+    return;
+  }
+  const D3DXVECTOR2 *dir = _circle_tables.get(cmd.segments);
+  tessellate_rounded_rect(canvas, canvas.vertex_transform, dir, cmd.p0, radii, cmd.w, cmd.segments, cmd.col);
+}
 
-  Bezier bb = Bezier::from_points(AsArray<D3DXVECTOR3>(pts, num));
+void Thud::emit_shape(Canvas& canvas, const DrawCommand& cmd, const D3DXVECTOR2& radii, float corner)
+{
+  ShapeInstance *s = (ShapeInstance *)canvas.shapes.alloc(1);
+  s->centre = D3DXVECTOR2(cmd.p0.x, cmd.p0.y);
+  s->radii = radii;
+  s->corner = corner;
+  s->z = cmd.p0.z;
+  s->col = cmd.col;
+}
 
-  TwInit(TW_DIRECT3D11, graphics.device(), graphics.context());
-  TwWindowSize(width, height);
+void Thud::emit_rect(Canvas& canvas, const DrawCommand& cmd)
+{
+  if (cmd.pipeline == kRectPipeline) {
+    RectInstance *r = (RectInstance *)canvas.rects.alloc(1);
+    r->pos = D3DXVECTOR2(cmd.p0.x, cmd.p0.y);
+    r->size = D3DXVECTOR2(cmd.p1.x, cmd.p1.y);
+    r->z = cmd.p0.z;
+    r->col = cmd.col;
+    return;
+  }
+  tessellate_rect(canvas, canvas.vertex_transform, cmd.p0, cmd.p1, cmd.col);
+}
 
-  TwBar *myBar = TwNewBar("NameOfMyTweakBar");
-  int apa = 10;
-  TwAddVarRW(myBar, "NameOfMyVariable", TW_TYPE_INT32, &apa, "");
+void Thud::emit_line(Canvas& canvas, const DrawCommand& cmd)
+{
+  if (cmd.pipeline == kLinePipeline) {
+    LineInstance *l = (LineInstance *)canvas.lines.alloc(1);
+    l->p0 = D3DXVECTOR2(cmd.p0.x, cmd.p0.y);
+    l->p1 = D3DXVECTOR2(cmd.p1.x, cmd.p1.y);
+    l->w = cmd.w;
+    l->z = cmd.p0.z;
+    l->col = cmd.col;
+    return;
+  }
+  tessellate_line(canvas, canvas.vertex_transform, cmd.p0, cmd.p1, cmd.w, cmd.col);
+}
 
-  while (WM_QUIT != msg.message) {
-    if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-      TranslateMessage(&msg);
-      DispatchMessage(&msg);
-    } else {
-      graphics.clear(D3DXCOLOR(0.5f, 0.5f, 0.5f, 1));
-      //thud.start_frame();
-      //thud.clear(D3DXCOLOR(0, 1, 0, 1));
-      //thud.set_fill(D3DXCOLOR(1,1,1,1));
-			//thud.circle(D3DXVECTOR3(width/2.0f, height/2.0f,0.5f), width/4.0f);
-			//thud.rect(D3DXVECTOR3(0,0,0), D3DXVECTOR3(width/2.0f, height/2.0f, 0));
-			//thud.rect(D3DXVECTOR3(width/2,height/2,0), D3DXVECTOR3(width/2.0f, height/2.0f, 0));
-
-			D3DXVECTOR3 prev = bb.interpolate(0); // bezier(0, D3DXVECTOR3(0, 200, 0), D3DXVECTOR3(40, 300, 0), D3DXVECTOR3(250, 0, 0), D3DXVECTOR3(500, 200, 0));
-			for (int i = 0; i < num-1; ++i) {
-				for (int j = 0; j <= 10; ++j) {
-					D3DXVECTOR3 cur = bb.interpolate(i+j/10.0f); //bezier(i/10.0f + j/100.0f, D3DXVECTOR3(0, 200, 0), D3DXVECTOR3(40, 300, 0), D3DXVECTOR3(250, 0, 0), D3DXVECTOR3(500, 200, 0));
-					//thud.line(prev, cur, 1);
-					prev = cur;
-				}
-			}
-      //thud.render();
-      TwDraw();
-      graphics.present();
-    }
+void Thud::emit_polyline(Canvas& canvas, const DrawCommand& cmd)
+{
+  // pieces share their end points, so the line stays connected across them
+  const D3DXVECTOR3 *pts = _draw_list.points(cmd.first);
+  const int n = cmd.segments;
+  const int step = max_polyline_points() - 1;
+  for (int first = 0; first < n - 1; first += step) {
+    const int last = min(first + step, n - 1);
+    tessellate_polyline(canvas, canvas.vertex_transform, pts, n, first, last, cmd.w, (LineJoin)cmd.join, cmd.col);
   }
+}
 
-  TwTerminate();
-  thud.close();
-  graphics.close();
+void Thud::push_state()
+{
+  _state_stack.push_back(State());
+}
 
-  return (int)msg.wParam;
+void Thud::pop_state()
+{
+  _state_stack.pop_back();   
 }
+
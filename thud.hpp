@@ -0,0 +1,354 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "backend.hpp"
+#include "vertex_arena.hpp"
+#include "draw_list.hpp"
+#include "tessellate.hpp"
+#include "cull.hpp"
+#include "circle_table.hpp"
+#include "screen_to_clip.hpp"
+#include "instrument.hpp"
+
+class Recorder;
+class TaskPool;
+struct Bezier;
+
+// Thud - 2d renderer
+struct Thud
+{
+  Thud();
+
+  static Thud& instance();
+
+  struct Options
+  {
+    Options()
+      : chunk_size(32 * 1024)
+      , max_chunks(8)
+      , indexed(false)
+      , transform_in_shader(false)
+      , instanced(false)
+      , deferred(false)
+      , packed_vertices(false)
+      , ring_buffer(false)
+      , analytic_shapes(false)
+    {
+    }
+    // vertices per canvas chunk, and how many chunks a canvas may hold before
+    // it starts flushing. Peak vertex memory per canvas is
+    // chunk_size * max_chunks * sizeof(PosCol). chunk_size is at least 24
+    int chunk_size;
+    int max_chunks;
+    // emit unique vertices plus an index stream instead of a plain triangle
+    // list. Circles go from 3*N to N+1 vertices, and rects and lines from 6 to
+    // 4, at the cost of 2 (or 4) bytes per index
+    bool indexed;
+    // write vertices in screen space and let the vertex shader apply the
+    // screen to clip transform, instead of doing it on the cpu
+    bool transform_in_shader;
+    // rects and lines write a single RectInstance/LineInstance record, and
+    // the vertex shader expands it. They are drawn after the triangles of
+    // the canvas, so use z to order them against circles
+    bool instanced;
+    // record the primitives, and write them to the canvas in render(), sorted
+    // by canvas, blend mode, pipeline and depth, so primitives with the same
+    // state share a draw. Alpha blended primitives are drawn back to front.
+    // Uses the extents set when render() is called
+    bool deferred;
+    // upload 12 byte PackedVertex vertices instead of 28 byte PosCol ones,
+    // see packed_vertex.hpp. They are written as PosCol and packed as each
+    // chunk is unmapped. Retained groups stay PosCol, as they're uploaded
+    // once
+    bool packed_vertices;
+    // each canvas writes its triangles to one buffer of
+    // chunk_size * max_chunks vertices used as a ring, see VertexArena. A
+    // frame is appended after the last with no-overwrite, so it can be
+    // written while the GPU is still drawing the one before, and draws after
+    // render() go after it in the same way. Instanced rects and lines keep
+    // their chunks
+    bool ring_buffer;
+    // circles, ellipses and rounded rects write a single ShapeInstance, and
+    // the pixel shader finds their edges with a distance function, so they
+    // stay smooth at any size for the same cost. Blended ones get an
+    // antialiased edge. The segment counts are ignored, and like instanced
+    // rects they're drawn after the triangles of the canvas
+    bool analytic_shapes;
+  };
+
+  // Thud takes ownership of the backend
+  bool init(Backend *backend, const Options& options = Options());
+  bool close();
+
+  void push_state();
+  void pop_state();
+
+  // Layers. Canvas 0 is made by init, and add_canvas adds one on top and
+  // returns its index. Each canvas has its own vertex storage, extents and
+  // scale, and render() draws them in order, each over the ones before,
+  // followed by the retained groups used in it. A canvas that runs out of
+  // chunks mid frame is drawn early, under the ones before it.
+  //
+  // Drawing goes to the current canvas, which add_canvas sets. set_extents
+  // and set_canvas_scale change the current one
+  int add_canvas();
+  void set_canvas(int index);
+  int num_canvases() const { return (int)_canvases.size(); }
+  void set_extents(const D3DXVECTOR2& extents);
+  // zoom the canvas about the centre of the target. It's applied by the
+  // shader, so a cached canvas can be zoomed without drawing it again
+  void set_canvas_scale(const D3DXVECTOR2& scale);
+  // Cache what's drawn to the current canvas, like a retained group. Returns
+  // true when version has changed and the canvas has to be drawn, followed
+  // by end_cached_canvas, and false when last frame's geometry is drawn again
+  bool begin_cached_canvas(uint32_t version);
+  void end_cached_canvas();
+
+  void set_fill(const D3DXCOLOR& col);
+  void set_stroke(const D3DXCOLOR& col);
+  void set_blend(BlendMode mode);
+
+  void clear(const D3DXCOLOR& col);
+
+  // Primitives entirely outside what the canvas shows, which is the extents
+  // scaled by the zoom, or the scissor rect when one is set, are dropped
+  // before any vertex work, and rects and lines that are partly outside are
+  // clipped. Circles and polylines are drawn whole, so they can spill over
+  // the scissor rect. The scissor is part of the state, so push_state clears
+  // it and pop_state brings it back
+  void set_scissor(const D3DXVECTOR2& top_left, const D3DXVECTOR2& size);
+  void clear_scissor();
+
+  // circles and ellipses with less than one segment aren't drawn
+  void set_circle_segments(int num_segments);
+  // pick the segment count of each circle from its size on screen, so the
+  // rim never deviates more than max_error_px from the true circle.
+  // 0 goes back to the fixed circle_segments
+  void set_circle_tolerance(float max_error_px);
+  void circle(const D3DXVECTOR3& o, float r);
+  void circle(const D3DXVECTOR3& o, float r, int segments);
+
+  // radii are half the width and height. The segments are picked like a
+  // circle's, from the larger radius
+  void ellipse(const D3DXVECTOR3& o, const D3DXVECTOR2& radii);
+
+  void rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size);
+  // corner is clamped to half the smaller side. The corners take the
+  // segments of a circle of that radius between them, and like circles,
+  // rounded rects aren't clipped
+  void rounded_rect(const D3DXVECTOR3& top_left, const D3DXVECTOR3& size, float corner);
+
+  void line(const D3DXVECTOR3& p0, const D3DXVECTOR3& p1, float w);
+
+  // stroke the n points as one connected line of width w, joined with the
+  // current line join. Long polylines are split where they cross a chunk
+  void set_line_join(LineJoin join);
+  void polyline(const D3DXVECTOR3 *pts, int n, float w);
+
+  // flatten the curve into a polyline of width w, with as few segments as
+  // keep it within the curve tolerance of the curve on screen
+  void set_curve_tolerance(float max_error_px);
+  void bezier(const Bezier& curve, float w);
+
+  // tessellate on several threads: begin_recorder on this thread, draw into
+  // the recorders from any thread, then merge them here. merge writes
+  // straight to the canvas, ahead of anything in the deferred draw list.
+  // Recorders cull against what the canvas shows when begin_recorder is
+  // called, with their own scissor rect rather than Thud's
+  void begin_recorder(Recorder& recorder);
+  void merge(const Recorder& recorder);
+  // runs fn(i, recorder) for i in [0, n) on the pool, and merges the
+  // recorders in order of i, so the output doesn't depend on which thread
+  // ran what. The recorders are kept between calls
+  void record(TaskPool& pool, int n, const std::function<void (int, Recorder&)>& fn);
+
+  // Retained groups. The primitives drawn between begin_retained and
+  // end_retained are tessellated once, kept in static buffers on the backend,
+  // and drawn again every frame the group is used, until version changes.
+  // begin_retained returns true when the group has to be drawn again, in
+  // which case draw it and call end_retained. When it returns false the
+  // cached geometry is drawn and nothing else is needed, so a frame costs
+  // in proportion to what changed rather than to the whole scene.
+  //
+  // Groups are drawn by render() after the canvas they were used in, in the
+  // order they were used, so use z to order them against the canvas. Their vertices are in
+  // clip space unless Options::transform_in_shader is set, so change the
+  // version when the extents change. Use a few large groups rather than
+  // many small ones, as each costs at least a draw
+  bool begin_retained(uint32_t key, uint32_t version);
+  void end_retained();
+  // frees the group's buffers
+  void release_retained(uint32_t key);
+
+  void start_frame();
+  void render();
+
+  // draws issued by the last render()
+  int num_draws() const;
+  // how many more draws the last frame would have needed without sorting the
+  // draw list, 0 unless Options::deferred is set
+  int draws_saved() const { return _draws_saved; }
+  // primitives dropped by culling since start_frame, including those of
+  // the recorders merged
+  int num_culled() const { return _num_culled; }
+  // counters and times from start_frame to the end of render, all 0 unless
+  // built with THUD_STATS
+  const FrameStats& stats() const { return _stats; }
+
+  struct State
+  {
+    State()
+      : circle_segments(40)
+      , circle_tolerance(0)
+      , curve_tolerance(0.25f)
+      , line_join(kJoinMiter)
+      , scissor(false)
+      , fill(D3DXCOLOR(0,0,0,0))
+      , stroke(D3DXCOLOR(1,1,1,1))
+      , blend(kBlendDefault)
+    {
+    }
+    int circle_segments;
+    float circle_tolerance;
+    float curve_tolerance;
+    LineJoin line_join;
+    bool scissor;
+    Bounds scissor_bounds;
+    D3DXCOLOR fill;
+    D3DXCOLOR stroke;
+    BlendMode blend;
+  };
+
+  struct Retained
+  {
+    Retained() : version(0), canvas(0), verts(nullptr), indices(nullptr) {}
+    void close();
+
+    struct Run
+    {
+      int first;
+      int count;
+      BlendMode blend;
+    };
+
+    uint32_t version;
+    // drawn after this canvas
+    int canvas;
+    // static sinks, with 32 bit indices
+    VertexSink *verts;
+    VertexSink *indices;
+    // a draw per change of blend mode, counting indices if there are any
+    std::vector<Run> runs;
+  };
+
+  struct Canvas
+  {
+    Canvas() : scale(1, 1), extents(1, 1), visible(D3DXVECTOR2(0, 0), D3DXVECTOR2(1, 1)), pixels_per_unit(1) {}
+
+    bool init(Backend *backend, const Options& options, FrameStats *stats);
+    void close();
+
+    PosCol *alloc(int n)
+    {
+      return (PosCol *)verts.alloc(n);
+    }
+
+    PosCol *alloc_indexed(int num_verts, int num_indices, void **indices, int *base)
+    {
+      return (PosCol *)verts.alloc_indexed(num_verts, num_indices, indices, base);
+    }
+
+    bool indexed() const { return verts.indexed(); }
+    int index_stride() const { return verts.index_stride(); }
+
+    void begin();
+    void end();
+    // recompute the transforms and constants from extents and scale
+    void update(const D3DXVECTOR2& pixel_extents, bool transform_in_shader);
+
+    // zoom about the centre of the target, applied by the shader
+    D3DXVECTOR2 scale;
+    D3DXVECTOR2 extents;
+    ScreenToClip screen_to_clip;
+    // the transform the primitives apply to their vertices. Either the same
+    // as screen_to_clip, or identity if the shader does the work
+    ScreenToClip vertex_transform;
+    // the part of the screen on the target, which is the extents grown or
+    // shrunk about their centre by the zoom, and what primitives are culled
+    // against
+    Bounds visible;
+    // render target pixels per screen unit, zoom included, which the circle
+    // and curve tolerances are measured with
+    float pixels_per_unit;
+    FrameConstants constants;
+    // see begin_cached_canvas
+    Retained cache;
+    VertexArena verts;
+    // only used with Options::instanced
+    VertexArena rects;
+    VertexArena lines;
+    // only used with Options::analytic_shapes
+    VertexArena shapes;
+  };
+
+  // the largest segment count whose triangles fit in one canvas chunk
+  int max_circle_segments() const;
+  int adaptive_circle_segments(float r, float max_error_px) const;
+  // the circle segments the state asks for, at radius r
+  int state_circle_segments(float r) const;
+  Canvas& canvas() { return _canvases[_canvas]; }
+  const Canvas& canvas() const { return _canvases[_canvas]; }
+
+  // start recording group unless it's at version, see begin_retained
+  bool begin_capture(Retained& group, uint32_t version);
+  void end_capture();
+  // writes a primitive of the group being recorded
+  void capture(const DrawCommand& cmd);
+  void draw_retained(const Retained& group);
+
+  // the extents, clipped to the scissor rect
+  Bounds cull_bounds() const;
+  // true, and counted, if nothing of a primitive within b is visible
+  bool cull(const Bounds& b);
+
+  // the most points of a polyline that fit one canvas chunk
+  int max_polyline_points() const;
+
+  // fills in the state of cmd, and either records it or writes it to the canvas
+  void submit(DrawCommand& cmd);
+  void emit(const DrawCommand& cmd);
+  void emit_circle(Canvas& canvas, const DrawCommand& cmd);
+  void emit_ellipse(Canvas& canvas, const DrawCommand& cmd);
+  void emit_rounded_rect(Canvas& canvas, const DrawCommand& cmd);
+  void emit_shape(Canvas& canvas, const DrawCommand& cmd, const D3DXVECTOR2& radii, float corner);
+  void emit_rect(Canvas& canvas, const DrawCommand& cmd);
+  void emit_line(Canvas& canvas, const DrawCommand& cmd);
+  void emit_polyline(Canvas& canvas, const DrawCommand& cmd);
+
+  CircleTables _circle_tables;
+  DrawList _draw_list;
+  int _draws_saved;
+  int _num_culled;
+  int _retained_draws;
+  FrameStats _stats;
+  Options _options;
+  Backend *_backend;
+  std::deque<State> _state_stack;
+  // a deque, so the arenas can point at the constants of their canvas
+  std::deque<Canvas> _canvases;
+  int _canvas;
+  std::vector<Recorder *> _recorders;
+  std::unordered_map<uint32_t, Retained> _retained;
+  // the groups used this frame, and the one being recorded, with the
+  // recorder it's tessellated into
+  std::vector<Retained *> _retained_frame;
+  Retained *_capture;
+  Recorder *_capture_recorder;
+  // scratch for bezier, kept to avoid allocating every curve
+  std::vector<D3DXVECTOR3> _polyline;
+  static Thud *_instance;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+// The math and vertex types used by the renderer. On Windows these come from
+// D3DX and celsus; everywhere else we provide minimal stand-ins with the same
+// names, layout and semantics so the CPU side of Thud builds without D3D.
+
+#ifdef _WIN32
+
+#include <D3DX10math.h>
+#include <celsus/vertex_types.hpp>
+#include <celsus/math_utils.hpp>
+
+#else
+
+#include <math.h>
+#include <stdint.h>
+
+typedef uint32_t UINT32;
+
+struct D3DXVECTOR2
+{
+  D3DXVECTOR2() {}
+  D3DXVECTOR2(float x, float y) : x(x), y(y) {}
+
+  operator float*() { return &x; }
+  operator const float*() const { return &x; }
+
+  D3DXVECTOR2& operator+=(const D3DXVECTOR2& v) { x += v.x; y += v.y; return *this; }
+  D3DXVECTOR2& operator-=(const D3DXVECTOR2& v) { x -= v.x; y -= v.y; return *this; }
+  D3DXVECTOR2& operator*=(float s) { x *= s; y *= s; return *this; }
+  D3DXVECTOR2& operator/=(float s) { x /= s; y /= s; return *this; }
+
+  D3DXVECTOR2 operator-() const { return D3DXVECTOR2(-x, -y); }
+  D3DXVECTOR2 operator+(const D3DXVECTOR2& v) const { return D3DXVECTOR2(x + v.x, y + v.y); }
+  D3DXVECTOR2 operator-(const D3DXVECTOR2& v) const { return D3DXVECTOR2(x - v.x, y - v.y); }
+  D3DXVECTOR2 operator*(float s) const { return D3DXVECTOR2(x * s, y * s); }
+  D3DXVECTOR2 operator/(float s) const { return D3DXVECTOR2(x / s, y / s); }
+  friend D3DXVECTOR2 operator*(float s, const D3DXVECTOR2& v) { return v * s; }
+
+  bool operator==(const D3DXVECTOR2& v) const { return x == v.x && y == v.y; }
+  bool operator!=(const D3DXVECTOR2& v) const { return !(*this == v); }
+
+  float x, y;
+};
+
+struct D3DXVECTOR3
+{
+  D3DXVECTOR3() {}
+  D3DXVECTOR3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+  operator float*() { return &x; }
+  operator const float*() const { return &x; }
+
+  D3DXVECTOR3& operator+=(const D3DXVECTOR3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+  D3DXVECTOR3& operator-=(const D3DXVECTOR3& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+  D3DXVECTOR3& operator*=(float s) { x *= s; y *= s; z *= s; return *this; }
+  D3DXVECTOR3& operator/=(float s) { x /= s; y /= s; z /= s; return *this; }
+
+  D3DXVECTOR3 operator-() const { return D3DXVECTOR3(-x, -y, -z); }
+  D3DXVECTOR3 operator+(const D3DXVECTOR3& v) const { return D3DXVECTOR3(x + v.x, y + v.y, z + v.z); }
+  D3DXVECTOR3 operator-(const D3DXVECTOR3& v) const { return D3DXVECTOR3(x - v.x, y - v.y, z - v.z); }
+  D3DXVECTOR3 operator*(float s) const { return D3DXVECTOR3(x * s, y * s, z * s); }
+  D3DXVECTOR3 operator/(float s) const { return D3DXVECTOR3(x / s, y / s, z / s); }
+  friend D3DXVECTOR3 operator*(float s, const D3DXVECTOR3& v) { return v * s; }
+
+  bool operator==(const D3DXVECTOR3& v) const { return x == v.x && y == v.y && z == v.z; }
+  bool operator!=(const D3DXVECTOR3& v) const { return !(*this == v); }
+
+  float x, y, z;
+};
+
+struct D3DXVECTOR4
+{
+  D3DXVECTOR4() {}
+  D3DXVECTOR4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+  operator float*() { return &x; }
+  operator const float*() const { return &x; }
+
+  float x, y, z, w;
+};
+
+struct D3DXCOLOR
+{
+  D3DXCOLOR() {}
+  D3DXCOLOR(float r, float g, float b, float a) : r(r), g(g), b(b), a(a) {}
+  // 0xAARRGGBB, like D3DCOLOR
+  D3DXCOLOR(UINT32 argb)
+    : r(((argb >> 16) & 0xff) / 255.0f)
+    , g(((argb >> 8) & 0xff) / 255.0f)
+    , b(((argb >> 0) & 0xff) / 255.0f)
+    , a(((argb >> 24) & 0xff) / 255.0f)
+  {
+  }
+
+  operator UINT32() const
+  {
+    return (to_byte(a) << 24) | (to_byte(r) << 16) | (to_byte(g) << 8) | to_byte(b);
+  }
+
+  operator float*() { return &r; }
+  operator const float*() const { return &r; }
+
+  bool operator==(const D3DXCOLOR& c) const { return r == c.r && g == c.g && b == c.b && a == c.a; }
+  bool operator!=(const D3DXCOLOR& c) const { return !(*this == c); }
+
+  float r, g, b, a;
+
+private:
+  static UINT32 to_byte(float v) { return v >= 1 ? 0xff : v <= 0 ? 0 : (UINT32)(v * 255.0f + 0.5f); }
+};
+
+struct PosCol
+{
+  PosCol() {}
+  PosCol(const D3DXVECTOR3& pos, const D3DXCOLOR& col) : pos(pos), col(col) {}
+  PosCol(const D3DXVECTOR2& pos, float z, const D3DXCOLOR& col) : pos(pos.x, pos.y, z), col(col) {}
+  D3DXVECTOR3 pos;
+  D3DXCOLOR col;
+};
+
+const double kPi = 3.14159265358979323846;
+
+inline D3DXVECTOR3 vec3_normalize(const D3DXVECTOR3& v)
+{
+  const float len = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+  return len > 0 ? v / len : v;
+}
+
+#define ELEMS_IN_ARRAY(x) (sizeof(x) / sizeof((x)[0]))
+#define SAFE_DELETE(x) do { delete (x); (x) = nullptr; } while (false)
+
+#endif
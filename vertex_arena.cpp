@@ -0,0 +1,249 @@
+#include "stdafx.h"
+#include "vertex_arena.hpp"
+#include "packed_vertex.hpp"
+#include <assert.h>
+
+VertexArena::VertexArena()
+  : _backend(nullptr)
+  , _constants(nullptr)
+  , _stats(nullptr)
+  , _cur(-1)
+  , _base(0)
+  , _ibase(0)
+  , _begin(nullptr)
+  , _ptr(nullptr)
+  , _end(nullptr)
+  , _ibegin(nullptr)
+  , _iptr(nullptr)
+  , _iend(nullptr)
+  , _stride(0)
+  , _sink_stride(0)
+  , _index_stride(0)
+  , _instance_kind(-1)
+  , _chunk_size(0)
+  , _index_chunk_size(0)
+  , _max_chunks(0)
+  , _num_draws(0)
+  , _blend(kBlendDefault)
+  , _flags(0)
+{
+}
+
+bool VertexArena::init(Backend *backend, int stride, int chunk_size, int max_chunks, int index_chunk_size, int flags)
+{
+  assert(chunk_size > 0 && max_chunks > 0);
+  assert(!(flags & kRing) || !instanced());
+  _backend = backend;
+  _flags = flags;
+  _stride = stride;
+  _sink_stride = stride;
+  if (packed()) {
+    assert(stride == sizeof(PosCol));
+    _sink_stride = sizeof(PackedVertex);
+    _staging.resize(chunk_size * stride);
+  }
+  _chunk_size = chunk_size;
+  _max_chunks = max_chunks;
+  _index_chunk_size = index_chunk_size;
+  _index_stride = index_chunk_size == 0 ? 0 : chunk_size <= 65536 ? 2 : 4;
+
+  // the first chunk is created up front so a failing backend is caught in init,
+  // and it's the only one a ring has
+  if (!add_chunk())
+    return false;
+  if (ringed()) {
+    const Chunk& chunk = _chunks[0];
+    if (!_ring.init(backend, chunk.sink) || (chunk.indices && !_index_ring.init(backend, chunk.indices)))
+      return false;
+  }
+  return true;
+}
+
+bool VertexArena::init_instances(Backend *backend, InstanceKind kind, int stride, int chunk_size, int max_chunks)
+{
+  _instance_kind = kind;
+  return init(backend, stride, chunk_size, max_chunks);
+}
+
+void VertexArena::close()
+{
+  _ring.close();
+  _index_ring.close();
+  for (size_t i = 0; i < _chunks.size(); ++i) {
+    delete _chunks[i].sink;
+    delete _chunks[i].indices;
+  }
+  _chunks.clear();
+  _runs.clear();
+  _cur = -1;
+  _begin = _ptr = _end = nullptr;
+  _ibegin = _iptr = _iend = nullptr;
+}
+
+void VertexArena::begin()
+{
+  _num_draws = 0;
+  _blend = kBlendDefault;
+  map_chunk(0);
+}
+
+void VertexArena::end()
+{
+  unmap_chunk();
+  flush();
+  if (ringed()) {
+    _ring.end_frame();
+    if (_index_stride)
+      _index_ring.end_frame();
+  }
+}
+
+bool VertexArena::add_chunk()
+{
+  // a ring's one chunk holds all of them
+  const int chunks = ringed() ? _max_chunks : 1;
+  VertexSink *sink = instanced()
+    ? _backend->create_instance_sink(_stride, _chunk_size)
+    : _backend->create_vertex_sink(_sink_stride, chunks * _chunk_size);
+  if (!sink)
+    return false;
+
+  VertexSink *indices = nullptr;
+  if (_index_stride) {
+    indices = _backend->create_index_sink(_index_stride, chunks * _index_chunk_size);
+    if (!indices) {
+      delete sink;
+      return false;
+    }
+  }
+
+  _chunks.push_back(Chunk(sink, indices));
+  return true;
+}
+
+void *VertexArena::alloc_slow(int n, int num_indices)
+{
+  assert(n <= _chunk_size && num_indices <= _index_chunk_size);
+  unmap_chunk();
+
+  const int next = _cur + 1;
+  if (ringed()) {
+    // going back to the start of the ring may discard, which would lose
+    // what's not been drawn
+    if (!_ring.fits(_chunk_size) || (_index_stride && !_index_ring.fits(_index_chunk_size)))
+      flush();
+    map_chunk(0);
+  } else if (next < (int)_chunks.size()) {
+    map_chunk(next);
+  } else if (next < _max_chunks && add_chunk()) {
+    map_chunk(next);
+  } else {
+    // at the limit, or the backend can't give us more memory
+    flush();
+    map_chunk(0);
+  }
+
+  char *p = _ptr;
+  _ptr += n * _stride;
+  _iptr += num_indices * _index_stride;
+  return p;
+}
+
+void VertexArena::map_chunk(int idx)
+{
+  Chunk& chunk = _chunks[idx];
+  _cur = idx;
+  _base = ringed() ? _ring.alloc(_chunk_size) : 0;
+  // a packed chunk is mapped when it's packed, in unmap_chunk
+  _begin = _ptr = packed() ? &_staging[0] : (char *)(ringed() ? _ring.map() : chunk.sink->map());
+  _end = _ptr + _chunk_size * _stride;
+  chunk.count = 0;
+  THUD_COUNT(_stats, bytes_mapped, _chunk_size * _sink_stride);
+
+  if (chunk.indices) {
+    _ibase = ringed() ? _index_ring.alloc(_index_chunk_size) : 0;
+    _ibegin = _iptr = (char *)(ringed() ? _index_ring.map() : chunk.indices->map());
+    _iend = _iptr + _index_chunk_size * _index_stride;
+    chunk.index_count = 0;
+    THUD_COUNT(_stats, bytes_mapped, _index_chunk_size * _index_stride);
+  }
+
+  // a chunk always starts a new draw
+  _runs.push_back(Run(idx, chunk_first(), _base, _blend));
+}
+
+void VertexArena::start_run(BlendMode mode)
+{
+  _blend = mode;
+  if (_cur < 0)
+    return;
+
+  const int first = chunk_first() + (_index_stride
+    ? (int)(_iptr - _ibegin) / _index_stride
+    : (int)(_ptr - _begin) / _stride);
+  if (_runs.back().chunk == _cur && _runs.back().first == first) {
+    // nothing was allocated with the previous mode, so drop its run, and
+    // keep extending the one before if it has the same mode
+    _runs.pop_back();
+    if (!_runs.empty() && _runs.back().chunk == _cur && _runs.back().blend == mode)
+      return;
+  }
+  _runs.push_back(Run(_cur, first, _base, mode));
+}
+
+void VertexArena::unmap_chunk()
+{
+  if (_cur < 0)
+    return;
+  Chunk& chunk = _chunks[_cur];
+  const int n = (int)(_ptr - _begin) / _stride;
+  char *end = _ptr;
+  if (packed()) {
+    assert(_constants);
+    PackedVertex *dst = (PackedVertex *)(ringed() ? _ring.map() : chunk.sink->map());
+    pack_vertices((const PosCol *)_begin, dst, n, _constants->packed);
+    end = (char *)(dst + n);
+  }
+  // counts include what's before the chunk in a ring
+  chunk.count = ringed() ? _ring.unmap(end) : chunk.sink->unmap(end);
+  if (chunk.indices)
+    chunk.index_count = ringed() ? _index_ring.unmap(_iptr) : chunk.indices->unmap(_iptr);
+  if (instanced())
+    THUD_COUNT(_stats, instances, n);
+  else
+    THUD_COUNT(_stats, vertices, n);
+  THUD_COUNT(_stats, bytes_uploaded, n * _sink_stride + (int)(_iptr - _ibegin));
+  _begin = _ptr = _end = nullptr;
+  _ibegin = _iptr = _iend = nullptr;
+}
+
+void VertexArena::flush()
+{
+  // draw all the runs written since the last flush, in order
+  if (_constants && !_runs.empty())
+    _backend->set_constants(*_constants);
+  for (size_t r = 0; r < _runs.size(); ++r) {
+    const Run& run = _runs[r];
+    const Chunk& chunk = _chunks[run.chunk];
+    const bool last = r + 1 == _runs.size() || _runs[r + 1].chunk != run.chunk;
+    const int end = !last ? _runs[r + 1].first : chunk.indices ? chunk.index_count : chunk.count;
+    const int count = end - run.first;
+    if (count <= 0)
+      continue;
+
+    _backend->set_blend(run.blend);
+    if (chunk.indices)
+      _backend->draw_indexed(chunk.sink, chunk.indices, run.first, count, run.base);
+    else if (instanced())
+      _backend->draw_instanced((InstanceKind)_instance_kind, chunk.sink, run.first, count);
+    else
+      _backend->draw(chunk.sink, run.first, count);
+    ++_num_draws;
+    THUD_COUNT(_stats, draw_calls, 1);
+  }
+
+  for (int i = 0; i <= _cur; ++i)
+    _chunks[i].count = _chunks[i].index_count = 0;
+  _runs.clear();
+  _cur = -1;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <vector>
+#include "backend.hpp"
+#include "instrument.hpp"
+#include "ring_buffer.hpp"
+
+// Chunked storage for a stream of fixed-stride elements. Each chunk is a
+// VertexSink holding chunk_size elements. When a chunk is full the next one is
+// mapped, creating it on demand, and when max_chunks are in use the full chunks
+// are drawn and recycled, so memory stays bounded at
+// max_chunks * chunk_size * stride bytes no matter how much is drawn.
+// An allocation never straddles two chunks.
+//
+// An indexed arena pairs every chunk with an index sink, and indices are
+// relative to the start of their chunk. They are 16 bit when a chunk holds at
+// most 64K vertices, and 32 bit otherwise.
+//
+// An instance arena holds RectInstance or LineInstance records, and its
+// chunks are drawn with draw_instanced.
+//
+// A packed arena hands out PosCol vertices from a staging chunk in system
+// memory, and packs them into the backend's sink as PackedVertex when the
+// chunk is unmapped, using the packed range of the constants, which must be
+// set.
+//
+// A ring arena has a single sink of chunk_size * max_chunks elements (and
+// one for the indices), suballocated by a RingBuffer. A chunk is then the
+// space for chunk_size elements at the head of the ring, which is mapped with
+// no-overwrite, so begin carries on after what the GPU may still be drawing
+// instead of discarding the first chunk, and the space is reused once the
+// fence after its frame has passed. The ring starts over from the start of
+// the sink with discard when it runs out, drawing what's written so far
+// first. Indices stay relative to their chunk, and are drawn with a base
+// vertex. Instances can't be ringed, as D3D11.0 can't map a structured
+// buffer with no-overwrite.
+//
+// Each chunk is drawn as a run of draws, one per blend mode change. Elements
+// allocated after set_blend go into a new draw, unless the mode is the same
+// as the current one.
+class VertexArena
+{
+public:
+  VertexArena();
+
+  enum Flags
+  {
+    // stride must be sizeof(PosCol)
+    kPacked = 1 << 0,
+    kRing = 1 << 1,
+  };
+
+  // index_chunk_size == 0 gives a non-indexed arena
+  bool init(Backend *backend, int stride, int chunk_size, int max_chunks, int index_chunk_size = 0, int flags = 0);
+  bool init_instances(Backend *backend, InstanceKind kind, int stride, int chunk_size, int max_chunks);
+  void close();
+
+  // map the first chunk
+  void begin();
+  // unmap the current chunk and draw everything written since the last
+  // flush. A ring arena then fences what it drew, and can be begun again
+  // straight away to draw more in the same frame
+  void end();
+
+  // constants set on the backend before each flush, if not null. The
+  // arena doesn't own them
+  void set_constants(const FrameConstants *constants) { _constants = constants; }
+  // where the arena counts what it maps, writes and draws, if not null and
+  // THUD_STATS is on. The arena doesn't own it
+  void set_stats(FrameStats *stats) { _stats = stats; }
+
+  // blend mode of the elements allocated from here on
+  void set_blend(BlendMode mode)
+  {
+    if (mode != _blend)
+      start_run(mode);
+  }
+  BlendMode blend() const { return _blend; }
+
+  // returns space for n contiguous elements, n <= chunk_size()
+  void *alloc(int n)
+  {
+    char *p = _ptr;
+    char *e = p + n * _stride;
+    if (e <= _end) {
+      _ptr = e;
+      return p;
+    }
+    return alloc_slow(n, 0);
+  }
+
+  // returns space for num_verts elements and num_indices indices. The
+  // indices are written to *indices, and must be offset by *base
+  void *alloc_indexed(int num_verts, int num_indices, void **indices, int *base)
+  {
+    char *p = _ptr;
+    char *e = p + num_verts * _stride;
+    char *ip = _iptr;
+    char *ie = ip + num_indices * _index_stride;
+    if (e > _end || ie > _iend) {
+      p = (char *)alloc_slow(num_verts, num_indices);
+      ip = _iptr - num_indices * _index_stride;
+    } else {
+      _ptr = e;
+      _iptr = ie;
+    }
+    *indices = ip;
+    *base = (int)(p - _begin) / _stride;
+    return p;
+  }
+
+  // elements and indices that still fit in the current chunk
+  int available() const { return _stride ? (int)(_end - _ptr) / _stride : 0; }
+  int available_indices() const { return _index_stride ? (int)(_iend - _iptr) / _index_stride : 0; }
+
+  bool indexed() const { return _index_stride != 0; }
+  bool instanced() const { return _instance_kind >= 0; }
+  bool packed() const { return (_flags & kPacked) != 0; }
+  bool ringed() const { return (_flags & kRing) != 0; }
+  // the vertex ring of a ring arena
+  const RingBuffer& ring() const { return _ring; }
+  int index_stride() const { return _index_stride; }
+  int chunk_size() const { return _chunk_size; }
+  int index_chunk_size() const { return _index_chunk_size; }
+  int max_chunks() const { return _max_chunks; }
+  int num_chunks() const { return (int)_chunks.size(); }
+
+  // draws issued by the last begin/end pair, including flushes
+  int num_draws() const { return _num_draws; }
+
+private:
+  struct Chunk
+  {
+    Chunk(VertexSink *sink, VertexSink *indices) : sink(sink), indices(indices), count(0), index_count(0) {}
+    VertexSink *sink;
+    VertexSink *indices;
+    int count;
+    int index_count;
+  };
+
+  // a draw starts at first in chunk, and ends at the next run or the end of
+  // the chunk. first counts indices in an indexed arena
+  struct Run
+  {
+    Run(int chunk, int first, int base, BlendMode blend) : chunk(chunk), first(first), base(base), blend(blend) {}
+    int chunk;
+    int first;
+    // the base vertex of an indexed draw
+    int base;
+    BlendMode blend;
+  };
+
+  void *alloc_slow(int n, int num_indices);
+  bool add_chunk();
+  // where the current chunk starts in the sink, which is only not 0 for a
+  // ring, in elements or in indices
+  int chunk_first() const { return _index_stride ? _ibase : _base; }
+  void map_chunk(int idx);
+  void unmap_chunk();
+  void flush();
+  void start_run(BlendMode mode);
+
+  Backend *_backend;
+  const FrameConstants *_constants;
+  FrameStats *_stats;
+  std::vector<Chunk> _chunks;
+  std::vector<Run> _runs;
+  int _cur;
+  // elements and indices before _begin and _ibegin in the sinks
+  int _base;
+  int _ibase;
+  char *_begin;
+  char *_ptr;
+  char *_end;
+  char *_ibegin;
+  char *_iptr;
+  char *_iend;
+  int _stride;
+  // of the backend's sinks, which differs from _stride when packed
+  int _sink_stride;
+  int _index_stride;
+  int _instance_kind;
+  int _chunk_size;
+  int _index_chunk_size;
+  int _max_chunks;
+  int _num_draws;
+  BlendMode _blend;
+  int _flags;
+  // the PosCol chunk of a packed arena
+  std::vector<char> _staging;
+  RingBuffer _ring;
+  RingBuffer _index_ring;
+};